@@ -0,0 +1,41 @@
+--
+-- benchmark for decoding the string-heavy payloads.
+--
+-- usage: lua ./bench/decode_string.lua [niter]
+--
+local yyjson = require('yyjson')
+
+local NITER = tonumber(arg[1]) or 200
+
+-- generate the payload that contains the long string values and keys
+local function gen_payload()
+    local list = {}
+    for i = 1, 2000 do
+        list[i] = {
+            ['identifier_of_the_record'] = string.format('%08d', i),
+            ['description_of_the_record'] = string.rep('lorem ipsum ', 16),
+            ['tags_of_the_record'] = {
+                string.rep('a', 64),
+                string.rep('b', 64),
+                string.rep('c', 64),
+            },
+        }
+    end
+    return assert(yyjson.encode(list))
+end
+
+local s = gen_payload()
+-- warm up
+for _ = 1, 10 do
+    assert(yyjson.decode(s))
+end
+
+local t = os.clock()
+for _ = 1, NITER do
+    assert(yyjson.decode(s))
+end
+t = os.clock() - t
+
+print(string.format('decode string-heavy payload: %d bytes x %d', #s, NITER))
+print(string.format('  %.3f sec, %.2f MB/s, %.1f ops/s', t,
+                    #s * NITER / t / 1024 / 1024, NITER / t))
@@ -0,0 +1,73 @@
+--
+-- benchmark for encoding the tables that are tagged as an array or an object.
+--
+-- usage: lua ./bench/encode_marker.lua [niter]
+--
+local yyjson = require('yyjson')
+
+local NITER = tonumber(arg[1]) or 200
+
+-- generate the list of the empty tables that are tagged by the function
+local function gen_payload(tag)
+    local list = {}
+    for i = 1, 5000 do
+        list[i] = {
+            tags = tag({}, 'array'),
+            attrs = tag({}, 'object'),
+        }
+    end
+    return list
+end
+
+local MARKER = {
+    array = yyjson.AS_ARRAY,
+    object = yyjson.AS_OBJECT,
+}
+local USERMT = {
+    array = {
+        __jsontype = 'array',
+    },
+    object = {
+        __jsontype = 'object',
+    },
+}
+
+local TAGS = {
+    {
+        '-1st element marker',
+        function(t, kind)
+            t[-1] = MARKER[kind]
+            return t
+        end,
+    },
+    {
+        'yyjson.as_array/as_object',
+        function(t, kind)
+            return kind == 'array' and yyjson.as_array(t) or
+                       yyjson.as_object(t)
+        end,
+    },
+    {
+        '__jsontype metatable',
+        function(t, kind)
+            return setmetatable(t, USERMT[kind])
+        end,
+    },
+}
+
+for _, tag in ipairs(TAGS) do
+    local v = gen_payload(tag[2])
+    -- warm up
+    for _ = 1, 10 do
+        assert(yyjson.encode(v))
+    end
+
+    local t = os.clock()
+    for _ = 1, NITER do
+        assert(yyjson.encode(v))
+    end
+    t = os.clock() - t
+
+    print(string.format('encode tagged tables by %s: x %d', tag[1], NITER))
+    print(string.format('  %.3f sec, %.1f ops/s', t, NITER / t))
+end
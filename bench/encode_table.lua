@@ -0,0 +1,79 @@
+--
+-- benchmark for encoding the array-heavy payloads with the table_mode and
+-- empty_table options.
+--
+-- usage: lua ./bench/encode_table.lua [niter]
+--
+local yyjson = require('yyjson')
+
+local NITER = tonumber(arg[1]) or 200
+
+-- generate the payload that contains many small arrays and empty tables
+local function gen_payload()
+    local list = {}
+    for i = 1, 5000 do
+        list[i] = {
+            i,
+            i * 2,
+            i * 3,
+            {
+                'foo',
+                'bar',
+            },
+            {},
+        }
+    end
+    return list
+end
+
+local v = gen_payload()
+for _, opts in ipairs({
+    {
+        name = 'default',
+        opts = {
+            table_mode = 'default',
+        },
+    },
+    {
+        name = 'rawlen',
+        opts = {
+            table_mode = 'rawlen',
+        },
+    },
+    {
+        name = 'strict',
+        opts = {
+            table_mode = 'strict',
+        },
+    },
+    {
+        name = 'empty_table=array',
+        opts = {
+            empty_table = 'array',
+        },
+    },
+    {
+        name = 'rawlen+direct',
+        opts = {
+            table_mode = 'rawlen',
+            direct = true,
+        },
+    },
+}) do
+    -- warm up
+    local s
+    for _ = 1, 10 do
+        s = assert(yyjson.encode(v, opts.opts))
+    end
+
+    local t = os.clock()
+    for _ = 1, NITER do
+        assert(yyjson.encode(v, opts.opts))
+    end
+    t = os.clock() - t
+
+    print(string.format('encode array-heavy payload by %s: %d bytes x %d',
+                        opts.name, #s, NITER))
+    print(string.format('  %.3f sec, %.2f MB/s, %.1f ops/s', t,
+                        #s * NITER / t / 1024 / 1024, NITER / t))
+end
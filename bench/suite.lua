@@ -0,0 +1,380 @@
+--
+-- benchmark suite for decoding and encoding the standard corpora.
+--
+-- usage: lua ./bench/suite.lua [niter [pattern]]
+--
+--   niter:   number of the iterations of each scenario (default: 20)
+--   pattern: run only the scenarios whose name matches the Lua pattern
+--
+-- the corpora are read from the $YYJSON_BENCH_DATA directory (default:
+-- ./bench/data) if the file exists, for example;
+--
+--   twitter.json, citm_catalog.json, canada.json
+--
+-- from https://github.com/miloyip/nativejson-benchmark/tree/master/data.
+-- otherwise, the payloads that have the same shape are generated with the
+-- fixed seed, so the results are reproducible without downloading them.
+--
+-- the allocations per op is the size of the Lua heap allocated by one
+-- operation in KB, that is measured with the garbage collector stopped.
+-- lua-cjson and dkjson are also measured if they are installed.
+--
+local yyjson = require('yyjson')
+
+local NITER = tonumber(arg[1]) or 20
+local PATTERN = arg[2]
+local DATADIR = os.getenv('YYJSON_BENCH_DATA') or './bench/data'
+
+-- Park-Miller minimal standard generator. the products never exceed 2^53,
+-- so the sequence is the same on every Lua version.
+local SEED = 20240101
+local function random(n)
+    SEED = SEED * 16807 % 2147483647
+    return SEED % n
+end
+
+local WORDS = {
+    'lorem',
+    'ipsum',
+    'dolor',
+    'sit',
+    'amet',
+    'consectetur',
+    'adipiscing',
+    'elit',
+    'こんにちは',
+    'Arrière-scène',
+    '@yyjson',
+    '#json',
+    'https://t.co/abc',
+}
+
+local function gen_text(nword)
+    local list = {}
+    for i = 1, nword do
+        list[i] = WORDS[random(#WORDS) + 1]
+    end
+    return table.concat(list, ' ')
+end
+
+-- string-heavy objects with nulls and nested entities like twitter.json
+local function gen_twitter()
+    local statuses = {}
+    for i = 1, 400 do
+        local id = 505874924095815681 + random(1000000)
+        statuses[i] = {
+            id = id,
+            id_str = tostring(id),
+            created_at = 'Sun Aug 31 00:29:15 +0000 2014',
+            text = gen_text(12 + random(12)),
+            truncated = false,
+            in_reply_to_status_id = yyjson.NULL,
+            in_reply_to_screen_name = yyjson.NULL,
+            user = {
+                id = 1186275104 + random(1000000),
+                name = gen_text(2),
+                screen_name = gen_text(1),
+                location = gen_text(3),
+                description = gen_text(16),
+                url = yyjson.NULL,
+                followers_count = random(100000),
+                friends_count = random(10000),
+                verified = false,
+                lang = 'ja',
+            },
+            entities = {
+                hashtags = yyjson.as_array({}),
+                urls = {
+                    {
+                        url = 'https://t.co/abc',
+                        indices = {
+                            random(100),
+                            random(100) + 100,
+                        },
+                    },
+                },
+                user_mentions = yyjson.as_array({}),
+            },
+            retweet_count = random(1000),
+            favorite_count = random(1000),
+            favorited = false,
+            retweeted = false,
+            lang = 'ja',
+        }
+    end
+    return {
+        statuses = statuses,
+        search_metadata = {
+            completed_in = 0.087,
+            max_id = 505874924095815681,
+            query = '%E4%B8%80',
+            count = 100,
+        },
+    }
+end
+
+-- objects keyed by the numeric strings and integer arrays like
+-- citm_catalog.json
+local function gen_citm()
+    local area_names = {}
+    local events = {}
+    local performances = {}
+    for i = 1, 200 do
+        area_names[tostring(205705993 + i)] = gen_text(2)
+    end
+    for i = 1, 400 do
+        local id = 138586341 + i
+        events[tostring(id)] = {
+            id = id,
+            name = gen_text(4),
+            description = yyjson.NULL,
+            logo = yyjson.NULL,
+            subTopicIds = {
+                337184269,
+                337184283 + random(100),
+            },
+            topicIds = {
+                324846099,
+                107888604 + random(100),
+            },
+            subjectCode = yyjson.NULL,
+        }
+    end
+    for i = 1, 800 do
+        local prices = {}
+        for j = 1, 1 + random(4) do
+            prices[j] = {
+                amount = 90250 + random(100) * 1000,
+                audienceSubCategoryId = 337100890,
+                seatCategoryId = 338937295 + j,
+            }
+        end
+        performances[i] = {
+            eventId = 138586341 + random(400),
+            id = 339887544 + i,
+            logo = yyjson.NULL,
+            name = yyjson.NULL,
+            prices = prices,
+            seatCategories = {
+                {
+                    areas = {
+                        {
+                            areaId = 205705999,
+                            blockIds = yyjson.as_array({}),
+                        },
+                    },
+                    seatCategoryId = 338937295,
+                },
+            },
+            start = 1372701600000 + random(1000000) * 1000,
+            venueCode = 'PLEYEL_PLEYEL',
+        }
+    end
+    return {
+        areaNames = area_names,
+        events = events,
+        performances = performances,
+    }
+end
+
+-- deeply nested arrays of the floating point numbers like canada.json
+local function gen_canada()
+    local polygons = {}
+    for i = 1, 40 do
+        local ring = {}
+        for j = 1, 500 do
+            ring[j] = {
+                -65.613616999999977 + random(1000000) / 1e5,
+                43.420273000000009 + random(1000000) / 1e5,
+            }
+        end
+        polygons[i] = {
+            ring,
+        }
+    end
+    return {
+        type = 'FeatureCollection',
+        features = {
+            {
+                type = 'Feature',
+                properties = {
+                    name = 'Canada',
+                },
+                geometry = {
+                    type = 'MultiPolygon',
+                    coordinates = polygons,
+                },
+            },
+        },
+    }
+end
+
+local CORPORA = {
+    {
+        name = 'twitter',
+        gen = gen_twitter,
+    },
+    {
+        name = 'citm_catalog',
+        gen = gen_citm,
+    },
+    {
+        name = 'canada',
+        gen = gen_canada,
+    },
+}
+
+local function load_corpus(corpus)
+    local f = io.open(DATADIR .. '/' .. corpus.name .. '.json', 'rb')
+    if f then
+        local s = f:read('*a')
+        f:close()
+        return s, 'file'
+    end
+    return assert(yyjson.encode(corpus.gen())), 'generated'
+end
+
+-- returns the NDJSON text that contains the elements of the largest array
+-- of the value
+local function to_ndjson(v)
+    local list = {}
+    local function find(t)
+        if type(t) == 'table' then
+            if #t > #list then
+                list = t
+            end
+            for _, child in pairs(t) do
+                find(child)
+            end
+        end
+    end
+    find(v)
+
+    local lines = {}
+    for i = 1, #list do
+        lines[i] = assert(yyjson.encode(list[i]))
+    end
+    return table.concat(lines, '\n'), #lines
+end
+
+local function measure(fn)
+    -- warm up
+    for _ = 1, 3 do
+        fn()
+    end
+
+    -- Lua heap allocated by one operation
+    collectgarbage('collect')
+    collectgarbage('stop')
+    local kb = collectgarbage('count')
+    fn()
+    kb = collectgarbage('count') - kb
+    collectgarbage('restart')
+
+    collectgarbage('collect')
+    local t = os.clock()
+    for _ = 1, NITER do
+        fn()
+    end
+    return os.clock() - t, kb
+end
+
+local function run(name, nbyte, fn)
+    if PATTERN and not string.find(name, PATTERN) then
+        return
+    end
+
+    local ok, elapsed, kb = pcall(measure, fn)
+    if not ok then
+        print(string.format('%-40s failed: %s', name, tostring(elapsed)))
+        return
+    end
+    print(string.format('%-40s %10.2f MB/s %10.1f ops/s %12.1f KB/op', name,
+                        nbyte * NITER / elapsed / 1024 / 1024, NITER / elapsed,
+                        kb))
+end
+
+-- the other libraries that are measured for the comparison
+local OTHERS = {}
+do
+    local ok, cjson = pcall(require, 'cjson')
+    if ok then
+        OTHERS[#OTHERS + 1] = {
+            name = 'cjson',
+            decode = cjson.decode,
+            encode = cjson.encode,
+        }
+    end
+    local dkjson
+    ok, dkjson = pcall(require, 'dkjson')
+    if ok then
+        OTHERS[#OTHERS + 1] = {
+            name = 'dkjson',
+            decode = dkjson.decode,
+            encode = dkjson.encode,
+            pretty = function(v)
+                return dkjson.encode(v, {
+                    indent = true,
+                })
+            end,
+        }
+    end
+end
+
+print(string.format('%s, niter: %d', _VERSION, NITER))
+for _, corpus in ipairs(CORPORA) do
+    local s, from = load_corpus(corpus)
+    local v = assert(yyjson.decode(s, true))
+    local pretty = assert(yyjson.encode(v, nil, yyjson.WRITE_PRETTY))
+    local ndjson, nline = to_ndjson(v)
+    local buf = assert(yyjson.buffer(#s))
+
+    print(string.format('\n%s.json (%s): %d bytes, ndjson: %d lines',
+                        corpus.name, from, #s, nline))
+    run('yyjson decode', #s, function()
+        assert(yyjson.decode(s))
+    end)
+    run('yyjson decode with_null', #s, function()
+        assert(yyjson.decode(s, true))
+    end)
+    run('yyjson decode with_ref', #s, function()
+        assert(yyjson.decode(s, nil, true))
+    end)
+    -- the buffer is parsed in-situ, so the content is written every time
+    run('yyjson decode INSITU', #s, function()
+        buf:reset()
+        assert(buf:write(s))
+        assert(yyjson.decode(buf, nil, nil, nil, yyjson.READ_INSITU))
+    end)
+    run('yyjson encode minify', #s, function()
+        assert(yyjson.encode(v))
+    end)
+    run('yyjson encode pretty', #pretty, function()
+        assert(yyjson.encode(v, nil, yyjson.WRITE_PRETTY))
+    end)
+    run('yyjson decode ndjson', #ndjson, function()
+        for pos, _, err in yyjson.decode_iter(ndjson) do
+            assert(pos, err)
+        end
+    end)
+
+    for _, lib in ipairs(OTHERS) do
+        local lv = lib.decode(s)
+        run(lib.name .. ' decode', #s, function()
+            assert(lib.decode(s))
+        end)
+        run(lib.name .. ' encode minify', #s, function()
+            assert(lib.encode(lv))
+        end)
+        if lib.pretty then
+            run(lib.name .. ' encode pretty', #pretty, function()
+                assert(lib.pretty(lv))
+            end)
+        end
+        run(lib.name .. ' decode ndjson', #ndjson, function()
+            for line in string.gmatch(ndjson, '[^\n]+') do
+                assert(lib.decode(line))
+            end
+        end)
+    end
+end
@@ -0,0 +1,128 @@
+--
+-- compare the throughput of the build options.
+--
+-- usage: lua ./bench/variants.lua [niter]
+--
+--   niter: number of the iterations of each scenario (default: 20)
+--
+-- each variant is built and installed with `luarocks make`, and measured by
+-- ./bench/suite.lua. the YYJSON_PGO=use variant is built with the profile
+-- that is collected by the YYJSON_PGO=generate build. the MB/s of the decode
+-- and encode minify scenarios are printed as a markdown table, and the
+-- default build is installed again at the end.
+--
+local NITER = tonumber(arg[1]) or 20
+local LUA = os.getenv('LUA') or 'lua'
+
+local VARIANTS = {
+    {
+        name = 'default',
+        args = '',
+    },
+    {
+        name = 'YYJSON_OPT=3',
+        args = 'YYJSON_OPT=3',
+    },
+    {
+        name = 'YYJSON_LTO=1',
+        args = 'YYJSON_LTO=1',
+    },
+    {
+        name = 'YYJSON_MARCH=native',
+        args = 'YYJSON_MARCH=native',
+    },
+    {
+        name = 'YYJSON_PGO=use',
+        args = 'YYJSON_PGO=use',
+        -- collect the profile with the instrumented build
+        setup = 'YYJSON_PGO=generate',
+    },
+}
+
+local SCENARIOS = {
+    'yyjson decode',
+    'yyjson encode minify',
+}
+
+local function exec(cmd)
+    print('$ ' .. cmd)
+    local ok = os.execute(cmd)
+    -- os.execute returns 0 on Lua 5.1 and true on later versions
+    assert(ok == true or ok == 0, 'failed to execute: ' .. cmd)
+end
+
+local function build(args)
+    exec('luarocks make ' .. args .. ' >/dev/null')
+end
+
+-- run the suite and return the MB/s of each scenario of each corpus
+local function measure()
+    local cmd = string.format('%s ./bench/suite.lua %d "^yyjson "', LUA,
+                              NITER)
+    local f = assert(io.popen(cmd))
+    local res = {}
+    local corpora = {}
+    local corpus
+
+    for line in f:lines() do
+        local name = line:match('^(%S+)%.json ')
+        if name then
+            corpus = name
+            corpora[#corpora + 1] = name
+            res[name] = {}
+        elseif corpus then
+            local scenario, mbps = line:match('^(.-)%s+([%d%.]+) MB/s')
+            if scenario then
+                res[corpus][scenario] = mbps
+            end
+        end
+    end
+    f:close()
+    return res, corpora
+end
+
+local rows = {}
+local corpora
+for _, v in ipairs(VARIANTS) do
+    if v.setup then
+        exec('rm -rf ./pgo')
+        build(v.setup)
+        measure()
+    end
+    build(v.args)
+    local res
+    res, corpora = measure()
+    rows[#rows + 1] = {
+        name = v.name,
+        res = res,
+    }
+end
+build('')
+
+local header = {
+    'build',
+}
+local sep = {
+    '---',
+}
+for _, corpus in ipairs(corpora) do
+    for _, scenario in ipairs(SCENARIOS) do
+        header[#header + 1] = corpus .. ' ' .. scenario:gsub('^yyjson ', '')
+        sep[#sep + 1] = '---:'
+    end
+end
+print(string.format('\n%s, niter: %d (MB/s)\n', _VERSION, NITER))
+print('| ' .. table.concat(header, ' | ') .. ' |')
+print('|' .. table.concat(sep, '|') .. '|')
+for _, row in ipairs(rows) do
+    local cols = {
+        '`' .. row.name .. '`',
+    }
+    for _, corpus in ipairs(corpora) do
+        for _, scenario in ipairs(SCENARIOS) do
+            cols[#cols + 1] = row.res[corpus] and row.res[corpus][scenario] or
+                                  '-'
+        end
+    end
+    print('| ' .. table.concat(cols, ' | ') .. ' |')
+end
@@ -23,511 +23,5410 @@
 
 #include "yyjson.h"
 #include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <lauxhlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define ARENA_MT "yyjson.arena"
+
+// bump allocator that can be reused across the decode/encode calls.
+// the blocks that do not fit into the buffer are allocated by lua_Alloc, and
+// the buffer will be grown to the peak usage of the call when it is released.
+typedef struct {
+    lua_Alloc allocf;
+    void *ud;
+    char *buf;
+    size_t size;
+    size_t used;
+    size_t maxsize;
+    int busy;
+} arena_t;
 
 typedef struct {
-    lua_State *L;
-    int ref;
-    lua_State *th;
     lua_Alloc allocf;
     void *ud;
     yyjson_alc alc;
+    arena_t *arena;
     size_t usesize;
     size_t maxsize;
+    size_t peak;
+    // number of the allocations and the total size of the allocated bytes
+    size_t nalloc;
+    size_t nrealloc;
+    size_t nbytes;
     int nomem;
 } memalloc_t;
 
+// header that is prepended to each block to keep its alloc size.
+// it is padded to 16 bytes so that the returned pointer keeps the alignment
+// of the block that allocated by lua_Alloc.
+typedef union {
+    size_t size;
+    char pad[16];
+} memhdr_t;
+
+// align the size of the block that allocated from the arena to 16 bytes
+#define MEMALIGN(n) (((n) + 15) & ~(size_t)15)
+
+static inline int arena_owns(arena_t *a, void *ptr)
+{
+    return a && (char *)ptr >= a->buf && (char *)ptr < a->buf + a->size;
+}
+
+static inline size_t memalloc_usage(memalloc_t *m)
+{
+    return m->usesize + (m->arena ? m->arena->used : 0);
+}
+
+static inline void memalloc_update_peak(memalloc_t *m)
+{
+    size_t usage = memalloc_usage(m);
+    if (usage > m->peak) {
+        m->peak = usage;
+    }
+}
+
+static inline int memalloc_exceeded(memalloc_t *m, size_t oldsize,
+                                    size_t size)
+{
+    if (size > SIZE_MAX - sizeof(memhdr_t)) {
+        return 1;
+    } else if (m->maxsize) {
+        size_t usesize = memalloc_usage(m) - oldsize;
+        return SIZE_MAX - size < usesize || size + usesize > m->maxsize;
+    }
+    return 0;
+}
+
 /* Same as libc's malloc(), should not be NULL. */
 static void *malloc_lua(void *ctx, size_t size)
 {
     memalloc_t *m = (memalloc_t *)ctx;
-    lua_State *L  = m->th;
-    void *ptr     = NULL;
+    arena_t *a    = m->arena;
+    memhdr_t *hdr = NULL;
 
-    if (m->maxsize &&
-        (SIZE_MAX - size < m->usesize || size + m->usesize > m->maxsize)) {
+    if (memalloc_exceeded(m, 0, size)) {
         // reached to maximum memory limit
         m->nomem = 1;
         return NULL;
+    } else if (a && a->size - a->used >= MEMALIGN(size)) {
+        // allocate from the arena
+        void *ptr = a->buf + a->used;
+        a->used += MEMALIGN(size);
+        m->nalloc++;
+        m->nbytes += size;
+        memalloc_update_peak(m);
+        return ptr;
     }
 
-    ptr = m->allocf(m->ud, NULL, 0, size);
-    if (ptr) {
-        // keep alloc size
-        // buffer for hexadecimal string 0xFFFFFFFFFFFFFFFF
-        char b[20]  = {0};
-        size_t blen = snprintf(b, sizeof(b), "%p", ptr);
-        size_t *sz  = NULL;
-
-        m->usesize += size;
-        lua_pushlstring(L, b, blen);
-        sz  = (size_t *)lua_newuserdata(L, sizeof(size_t));
-        *sz = size;
-        lua_rawset(L, 1);
-    } else {
+    hdr = (memhdr_t *)m->allocf(m->ud, NULL, 0, sizeof(memhdr_t) + size);
+    if (!hdr) {
         m->nomem = 1;
+        return NULL;
     }
+    // keep alloc size
+    hdr->size = size;
+    m->usesize += size;
+    m->nalloc++;
+    m->nbytes += size;
+    memalloc_update_peak(m);
 
-    return ptr;
+    return (void *)(hdr + 1);
 }
 
 /* Same as libc's realloc(), should not be NULL. */
 static void *realloc_lua(void *ctx, void *ptr, size_t old_size, size_t size)
 {
-    (void)old_size;
-    memalloc_t *m = (memalloc_t *)ctx;
-    lua_State *L  = m->th;
-    char b[20]    = {0};
-    size_t blen   = 0;
-    size_t *sz    = NULL;
-    void *newptr  = NULL;
-
-    if (m->maxsize &&
-        (SIZE_MAX - size < m->usesize || size + m->usesize > m->maxsize)) {
+    memalloc_t *m    = (memalloc_t *)ctx;
+    arena_t *a       = m->arena;
+    memhdr_t *hdr    = (memhdr_t *)ptr - 1;
+    memhdr_t *newhdr = NULL;
+    size_t oldsize   = 0;
+
+    if (arena_owns(a, ptr)) {
+        size_t offset = (size_t)((char *)ptr - a->buf);
+        void *newptr  = NULL;
+
+        if (memalloc_exceeded(m, MEMALIGN(old_size), size)) {
+            // reached to maximum memory limit
+            m->nomem = 1;
+            return NULL;
+        } else if (offset + MEMALIGN(old_size) == a->used &&
+                   a->size - offset >= MEMALIGN(size)) {
+            // resize the last block in place
+            a->used = offset + MEMALIGN(size);
+            m->nrealloc++;
+            m->nbytes += (size > old_size) ? size - old_size : 0;
+            memalloc_update_peak(m);
+            return ptr;
+        } else if ((newptr = malloc_lua(ctx, size))) {
+            memcpy(newptr, ptr, (old_size < size) ? old_size : size);
+        }
+        return newptr;
+    }
+
+    oldsize = hdr->size;
+    if (memalloc_exceeded(m, oldsize, size)) {
         // reached to maximum memory limit
         m->nomem = 1;
         return NULL;
     }
 
-    // get alloc size
-    blen = snprintf(b, sizeof(b), "%p", ptr);
-    lua_pushlstring(L, b, blen);
-    lua_pushvalue(L, 2);
-    lua_rawget(L, 1);
-    sz     = (size_t *)lua_topointer(L, -1);
-    // realloc
-    newptr = m->allocf(m->ud, ptr, *sz, size);
-    if (newptr) {
-        // remove old alloc size
-        lua_pushvalue(L, 2);
-        lua_pushnil(L);
-        lua_rawset(L, 1);
-
-        // keep new alloc size
-        m->usesize = m->usesize - *sz + size;
-        *sz        = size;
-        blen       = snprintf(b, sizeof(b), "%p", newptr);
-        lua_pushlstring(L, b, blen);
-        lua_replace(L, 2);
-        lua_rawset(L, 1);
-    } else {
+    newhdr = (memhdr_t *)m->allocf(m->ud, hdr, sizeof(memhdr_t) + oldsize,
+                                   sizeof(memhdr_t) + size);
+    if (!newhdr) {
         m->nomem = 1;
-        lua_settop(L, 1);
+        return NULL;
     }
+    // keep new alloc size
+    newhdr->size = size;
+    m->usesize   = m->usesize - oldsize + size;
+    m->nrealloc++;
+    m->nbytes += (size > oldsize) ? size - oldsize : 0;
+    memalloc_update_peak(m);
 
-    return newptr;
+    return (void *)(newhdr + 1);
 }
 
 /* Same as libc's free(), should not be NULL. */
 static void free_lua(void *ctx, void *ptr)
 {
     memalloc_t *m = (memalloc_t *)ctx;
-    lua_State *L  = m->th;
-    char b[20]    = {0};
-    size_t blen   = snprintf(b, sizeof(b), "%p", ptr);
-    size_t size   = 0;
-
-    // get alloc size
-    lua_pushlstring(L, b, blen);
-    lua_pushvalue(L, 2);
-    lua_rawget(L, 1);
-    size = *(size_t *)lua_topointer(L, -1);
-    lua_pop(L, 1);
-    // remove alloc size
-    lua_pushnil(L);
-    lua_rawset(L, 1);
-    // free
-    m->allocf(m->ud, ptr, size, 0);
-    m->usesize -= size;
+
+    // the blocks in the arena are released all at once by memalloc_dispose
+    if (ptr && !arena_owns(m->arena, ptr)) {
+        memhdr_t *hdr = (memhdr_t *)ptr - 1;
+        m->usesize -= hdr->size;
+        m->allocf(m->ud, hdr, sizeof(memhdr_t) + hdr->size, 0);
+    }
 }
 
 static void memalloc_dispose(memalloc_t *m)
 {
+    arena_t *a = m->arena;
+
     assert(m->usesize == 0);
-    lauxh_unref(m->L, m->ref);
+    if (a) {
+        // grow the buffer to the peak usage so that the next call is able
+        // to allocate all blocks from the arena
+        if (m->peak > a->size) {
+            size_t size = m->peak + m->peak / 8;
+            size        = (size + 4095) & ~(size_t)4095;
+            a->allocf(a->ud, a->buf, a->size, 0);
+            a->buf  = (char *)a->allocf(a->ud, NULL, 0, size);
+            a->size = (a->buf) ? size : 0;
+        }
+        a->used = 0;
+        a->busy = 0;
+    }
 }
 
-static void memalloc_init(memalloc_t *m, lua_State *L, size_t maxsize)
+static void memalloc_setup(memalloc_t *m, lua_State *L, arena_t *a,
+                           size_t maxsize)
 {
-    m->L      = L;
-    m->allocf = lua_getallocf(L, &m->ud);
-    m->th     = lua_newthread(L);
-    m->ref    = lauxh_ref(L);
-
-    // create the table that keeps alloc size of each pointer
-    // key: pointer address in representation of hexadecimal string
-    // value: alloc size that is stored in size_t*
-    lua_newtable(m->th);
+    m->allocf      = lua_getallocf(L, &m->ud);
     m->alc.malloc  = malloc_lua;
     m->alc.realloc = realloc_lua;
     m->alc.free    = free_lua;
     m->alc.ctx     = (void *)m;
+    m->arena       = a;
     m->usesize     = 0;
     m->maxsize     = maxsize;
+    m->peak        = 0;
+    m->nalloc      = 0;
+    m->nrealloc    = 0;
+    m->nbytes      = 0;
     m->nomem       = 0;
 }
 
-#define AS_OBJECT_MT "yyjson.as_object"
-#define AS_ARRAY_MT  "yyjson.as_array"
-#define AS_NULL_MT   "yyjson.null"
+// get the option field k of the table at idx. returns the type of the field
+// value that is pushed onto the stack.
+static int getoptfield(lua_State *L, int idx, const char *k, int type)
+{
+    int t = 0;
 
-static void *AS_OBJECT   = NULL;
-static void *AS_ARRAY    = NULL;
-static void *AS_NULL     = NULL;
-static int AS_OBJECT_REF = LUA_NOREF;
-static int AS_ARRAY_REF  = LUA_NOREF;
-static int AS_NULL_REF   = LUA_NOREF;
+    lua_getfield(L, idx, k);
+    t = lua_type(L, -1);
+    if (t != LUA_TNIL && t != type) {
+        lua_pushfstring(L, "%s must be %s", k, lua_typename(L, type));
+        luaL_argerror(L, idx, lua_tostring(L, -1));
+    }
+    return t;
+}
 
-#define tostring_lua(L, tname)                                                 \
-    do {                                                                       \
-        lauxh_isuserdataof((L), 1, (tname));                                   \
-        lua_pushliteral((L), tname);                                           \
-    } while (0)
+static int optfield_boolean(lua_State *L, int idx, const char *k, int def)
+{
+    if (lua_type(L, idx) == LUA_TTABLE) {
+        if (getoptfield(L, idx, k, LUA_TBOOLEAN) != LUA_TNIL) {
+            def = lua_toboolean(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    return def;
+}
+
+// get the string option k of the table at idx that is one of the names in
+// the list. returns the index of the name, or def if the field is nil.
+static int optfield_name(lua_State *L, int idx, const char *k,
+                         const char *const list[], int def, const char *msg)
+{
+    if (getoptfield(L, idx, k, LUA_TSTRING) != LUA_TNIL) {
+        const char *name = lua_tostring(L, -1);
+        for (def = 0; list[def]; def++) {
+            if (strcmp(name, list[def]) == 0) {
+                break;
+            }
+        }
+        if (!list[def]) {
+            luaL_argerror(L, idx, lua_pushfstring(L, "%s must be %s", k, msg));
+        }
+    }
+    lua_pop(L, 1);
+    return def;
+}
+
+// initialize the allocator with the mlimit argument at idx that is either an
+// integer, an arena or an options table
+static void memalloc_init(memalloc_t *m, lua_State *L, int idx)
+{
+    if (lua_type(L, idx) == LUA_TTABLE) {
+        // options table; { mlimit = <integer>, arena = <yyjson.arena> }
+        lua_Integer limit = 0;
+
+        lua_getfield(L, idx, "arena");
+        if (!lua_isnil(L, -1)) {
+            arena_t *a = NULL;
+            if (!lauxh_isuserdataof(L, -1, ARENA_MT)) {
+                luaL_argerror(L, idx, "arena must be yyjson.arena");
+            }
+            // the arena is kept alive by the options table
+            a = (arena_t *)lua_touserdata(L, -1);
+            lua_pop(L, 1);
+            if (a->busy) {
+                luaL_argerror(L, idx, "arena is already in use");
+            }
+            a->busy = 1;
+            memalloc_setup(m, L, a, a->maxsize);
+            return;
+        }
+        lua_pop(L, 1);
+        if (getoptfield(L, idx, "mlimit", LUA_TNUMBER) != LUA_TNIL) {
+            limit = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+        memalloc_setup(m, L, NULL, (limit < 0) ? 0 : (size_t)limit);
+    } else if (lauxh_isuserdataof(L, idx, ARENA_MT)) {
+        arena_t *a = (arena_t *)lua_touserdata(L, idx);
+        if (a->busy) {
+            luaL_argerror(L, idx, "arena is already in use");
+        }
+        a->busy = 1;
+        memalloc_setup(m, L, a, a->maxsize);
+    } else {
+        lua_Integer limit = lauxh_optinteger(L, idx, 0);
+        memalloc_setup(m, L, NULL, (limit < 0) ? 0 : (size_t)limit);
+    }
+}
+
+// get the arena of the mlimit argument at idx, or NULL if there is none.
+// the invalid arguments are left to memalloc_init.
+static arena_t *toarena(lua_State *L, int idx)
+{
+    arena_t *a = NULL;
+
+    if (lauxh_isuserdataof(L, idx, ARENA_MT)) {
+        a = (arena_t *)lua_touserdata(L, idx);
+    } else if (lua_type(L, idx) == LUA_TTABLE) {
+        lua_getfield(L, idx, "arena");
+        if (lauxh_isuserdataof(L, -1, ARENA_MT)) {
+            // the arena is kept alive by the options table
+            a = (arena_t *)lua_touserdata(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    return a;
+}
+
+// call the function at the top of the stack with the arguments of the running
+// function in protected mode. if the call raises an error, memalloc_dispose is
+// skipped, so the arena is released here and the error is raised again.
+static int arena_pcall(lua_State *L, arena_t *a)
+{
+    int top = lua_gettop(L) - 1;
+
+    for (int i = 1; i <= top; i++) {
+        lua_pushvalue(L, i);
+    }
+    if (lua_pcall(L, top, LUA_MULTRET, 0) != 0) {
+        a->used = 0;
+        a->busy = 0;
+        return lua_error(L);
+    }
+    return lua_gettop(L) - top;
+}
+
+// call fn in protected mode if the mlimit argument at idx is an arena. the
+// busy arena is passed to fn as is, so that memalloc_init raises the error.
+// the upvalue of the running function is passed on to fn.
+static int arena_call(lua_State *L, int idx, lua_CFunction fn)
+{
+    arena_t *a = toarena(L, idx);
+
+    if (!a || a->busy) {
+        return fn(L);
+    }
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_pushcclosure(L, fn, 1);
+    return arena_pcall(L, a);
+}
+
+// statistics of the decode/encode calls. the statistics are kept in the
+// registry of each Lua state, so the states in the different threads do not
+// share them, and passed to the functions that record them as the first
+// upvalue.
+#define STATS_KEY "yyjson.stats"
+
+typedef struct {
+    lua_Integer calls;
+    lua_Integer allocs;
+    lua_Integer reallocs;
+    lua_Integer bytes;
+    size_t peak;
+    // seconds spent in yyjson, and in the conversion from/to the Lua values
+    double yyjson_time;
+    double lua_time;
+} callstats_t;
+
+typedef struct {
+    callstats_t total;
+    callstats_t last;
+} stats_t;
+
+typedef struct {
+    stats_t decode;
+    stats_t encode;
+    // the elapsed times are measured only if enabled
+    int timing;
+} statsreg_t;
+
+static inline double stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// returns 0 if the timing is disabled
+static inline double stats_clock(statsreg_t *reg)
+{
+    return (reg->timing) ? stats_now() : 0;
+}
+
+static inline statsreg_t *stats_get(lua_State *L)
+{
+    return (statsreg_t *)lua_touserdata(L, lua_upvalueindex(1));
+}
+
+// record the statistics of the call from the allocator and the elapsed times
+static void stats_record(stats_t *s, memalloc_t *m, double yyjson_time,
+                         double lua_time)
+{
+    s->last = (callstats_t){
+        .calls       = 1,
+        .allocs      = (lua_Integer)m->nalloc,
+        .reallocs    = (lua_Integer)m->nrealloc,
+        .bytes       = (lua_Integer)m->nbytes,
+        .peak        = m->peak,
+        .yyjson_time = yyjson_time,
+        .lua_time    = lua_time,
+    };
+    s->total.calls++;
+    s->total.allocs += s->last.allocs;
+    s->total.reallocs += s->last.reallocs;
+    s->total.bytes += s->last.bytes;
+    s->total.yyjson_time += yyjson_time;
+    s->total.lua_time += lua_time;
+    if (m->peak > s->total.peak) {
+        s->total.peak = m->peak;
+    }
+}
+
+static void pushcallstats(lua_State *L, callstats_t *cs)
+{
+    lua_createtable(L, 0, 7);
+    lauxh_pushint2tbl(L, "calls", cs->calls);
+    lauxh_pushint2tbl(L, "allocs", cs->allocs);
+    lauxh_pushint2tbl(L, "reallocs", cs->reallocs);
+    lauxh_pushint2tbl(L, "bytes", cs->bytes);
+    lauxh_pushint2tbl(L, "peak", (lua_Integer)cs->peak);
+    lua_pushnumber(L, cs->yyjson_time);
+    lua_setfield(L, -2, "yyjson_time");
+    lua_pushnumber(L, cs->lua_time);
+    lua_setfield(L, -2, "lua_time");
+}
+
+static void pushstats(lua_State *L, stats_t *s)
+{
+    pushcallstats(L, &s->total);
+    pushcallstats(L, &s->last);
+    lua_setfield(L, -2, "last");
+}
+
+static int stats_lua(lua_State *L)
+{
+    int reset       = lauxh_optboolean(L, 1, 0);
+    statsreg_t *reg = stats_get(L);
+
+    reg->timing = lauxh_optboolean(L, 2, reg->timing);
+
+    lua_createtable(L, 0, 2);
+    pushstats(L, &reg->decode);
+    lua_setfield(L, -2, "decode");
+    pushstats(L, &reg->encode);
+    lua_setfield(L, -2, "encode");
+    if (reset) {
+        reg->decode = (stats_t){0};
+        reg->encode = (stats_t){0};
+    }
+    return 1;
+}
+
+static void init_stats(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+    if (lua_isnil(L, -1)) {
+        statsreg_t *reg = (statsreg_t *)lua_newuserdata(L, sizeof(statsreg_t));
+        *reg            = (statsreg_t){0};
+        lua_setfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+    }
+    lua_pop(L, 1);
+}
+
+// set the function with the statistics as the upvalue to the table at the
+// top of the stack
+static void pushstatsfn2tbl(lua_State *L, const char *k, lua_CFunction fn)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+    lua_pushcclosure(L, fn, 1);
+    lua_setfield(L, -2, k);
+}
+
+static int arena_gc(lua_State *L)
+{
+    arena_t *a = (arena_t *)lua_touserdata(L, 1);
+
+    if (a->buf) {
+        a->allocf(a->ud, a->buf, a->size, 0);
+        a->buf  = NULL;
+        a->size = 0;
+    }
+    return 0;
+}
+
+static int arena_len_lua(lua_State *L)
+{
+    arena_t *a = (arena_t *)luaL_checkudata(L, 1, ARENA_MT);
+    lua_pushinteger(L, a->size);
+    return 1;
+}
+
+static int arena_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, ARENA_MT ": %p", luaL_checkudata(L, 1, ARENA_MT));
+    return 1;
+}
+
+// push a new arena onto the stack, returns NULL if failed to allocate the
+// buffer.
+static arena_t *newarena(lua_State *L, size_t size, size_t maxsize)
+{
+    arena_t *a = (arena_t *)lua_newuserdata(L, sizeof(arena_t));
+
+    *a         = (arena_t){0};
+    a->allocf  = lua_getallocf(L, &a->ud);
+    a->maxsize = maxsize;
+    if (size > 0) {
+        a->size = MEMALIGN(size);
+        a->buf  = (char *)a->allocf(a->ud, NULL, 0, a->size);
+        if (!a->buf) {
+            a->size = 0;
+            return NULL;
+        }
+    }
+    luaL_getmetatable(L, ARENA_MT);
+    lua_setmetatable(L, -2);
+    return a;
+}
+
+static int arena_lua(lua_State *L)
+{
+    lua_Integer size    = lauxh_optinteger(L, 1, 0);
+    lua_Integer maxsize = lauxh_optinteger(L, 2, 0);
+
+    if (!newarena(L, (size < 0) ? 0 : (size_t)size,
+                  (maxsize < 0) ? 0 : (size_t)maxsize)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    return 1;
+}
+
+static inline void init_arena_mt(lua_State *L)
+{
+    luaL_newmetatable(L, ARENA_MT);
+    lauxh_pushfn2tbl(L, "__gc", arena_gc);
+    lauxh_pushfn2tbl(L, "__len", arena_len_lua);
+    lauxh_pushfn2tbl(L, "__tostring", arena_tostring_lua);
+    lua_pop(L, 1);
+}
+
+// growable byte buffer. the capacity is always followed by the
+// YYJSON_PADDING_SIZE bytes so that the content can be parsed in-situ.
+typedef struct {
+    const yyjson_alc *alc;
+    char *data;
+    size_t len;
+    size_t cap;
+} strbuf_t;
+
+static inline void strbuf_init(strbuf_t *b, const yyjson_alc *alc)
+{
+    *b = (strbuf_t){
+        .alc = alc,
+    };
+}
+
+static inline void strbuf_free(strbuf_t *b)
+{
+    if (b->data) {
+        b->alc->free(b->alc->ctx, b->data);
+    }
+    b->data = NULL;
+    b->len  = 0;
+    b->cap  = 0;
+}
+
+// ensure that the buffer has n bytes of free space
+static int strbuf_reserve(strbuf_t *b, size_t n)
+{
+    if (b->cap - b->len < n) {
+        size_t cap = (b->cap) ? b->cap : 256;
+        char *data = NULL;
+
+        if (SIZE_MAX - YYJSON_PADDING_SIZE - b->len < n) {
+            return 0;
+        }
+        while (cap - b->len < n) {
+            if (cap > (SIZE_MAX - YYJSON_PADDING_SIZE) / 2) {
+                cap = b->len + n;
+                break;
+            }
+            cap *= 2;
+        }
+        if (b->data) {
+            data = b->alc->realloc(b->alc->ctx, b->data,
+                                   b->cap + YYJSON_PADDING_SIZE,
+                                   cap + YYJSON_PADDING_SIZE);
+        } else {
+            data = b->alc->malloc(b->alc->ctx, cap + YYJSON_PADDING_SIZE);
+        }
+        if (!data) {
+            return 0;
+        }
+        b->data = data;
+        b->cap  = cap;
+    }
+    return 1;
+}
+
+static inline int strbuf_append(strbuf_t *b, const char *str, size_t len)
+{
+    if (!strbuf_reserve(b, len)) {
+        return 0;
+    }
+    memcpy(b->data + b->len, str, len);
+    b->len += len;
+    return 1;
+}
+
+// fill the padding bytes with zero, and return the content
+static inline char *strbuf_padded(strbuf_t *b)
+{
+    if (!b->data && !strbuf_reserve(b, 0)) {
+        return NULL;
+    }
+    memset(b->data + b->len, 0, YYJSON_PADDING_SIZE);
+    return b->data;
+}
+
+// remove the first n bytes
+static inline void strbuf_consume(strbuf_t *b, size_t n)
+{
+    if (n >= b->len) {
+        b->len = 0;
+    } else {
+        memmove(b->data, b->data + n, b->len - n);
+        b->len -= n;
+    }
+}
+
+#define BUFFER_MT "yyjson.buffer"
+
+typedef struct {
+    memalloc_t m;
+    strbuf_t buf;
+} buffer_t;
+
+static int buffer_write_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    int top     = lua_gettop(L);
+
+    for (int i = 2; i <= top; i++) {
+        size_t len      = 0;
+        const char *str = lauxh_checklstring(L, i, &len);
+        if (!strbuf_append(&b->buf, str, len)) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(ENOMEM));
+            return 2;
+        }
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+static int buffer_reserve_lua(lua_State *L)
+{
+    buffer_t *b      = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    lua_Integer size = lauxh_checkinteger(L, 2);
+
+    if (size > 0 && !strbuf_reserve(&b->buf, (size_t)size)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    lua_pushinteger(L, b->buf.cap);
+    return 1;
+}
+
+static int buffer_reset_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    b->buf.len  = 0;
+    return 0;
+}
+
+static int buffer_tostring_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    lua_pushlstring(L, (b->buf.data) ? b->buf.data : "", b->buf.len);
+    return 1;
+}
+
+// returns the pointer to the content and its length. the pointer is valid
+// until the buffer is modified.
+static int buffer_pointer_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    lua_pushlightuserdata(L, (b->buf.data) ? b->buf.data : (void *)"");
+    lua_pushinteger(L, b->buf.len);
+    return 2;
+}
+
+static int buffer_consume_lua(lua_State *L)
+{
+    buffer_t *b   = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    lua_Integer n = lauxh_checkinteger(L, 2);
+
+    if (n > 0) {
+        strbuf_consume(&b->buf, (size_t)n);
+    }
+    lua_pushinteger(L, b->buf.len);
+    return 1;
+}
+
+static int buffer_len_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    lua_pushinteger(L, b->buf.len);
+    return 1;
+}
+
+static int buffer_tostring_mt_lua(lua_State *L)
+{
+    lua_pushfstring(L, BUFFER_MT ": %p", luaL_checkudata(L, 1, BUFFER_MT));
+    return 1;
+}
+
+static int buffer_gc(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)lua_touserdata(L, 1);
+    strbuf_free(&b->buf);
+    return 0;
+}
+
+static int buffer_lua(lua_State *L)
+{
+    lua_Integer size = lauxh_optinteger(L, 1, 0);
+    buffer_t *b      = (buffer_t *)lua_newuserdata(L, sizeof(buffer_t));
+
+    memalloc_setup(&b->m, L, NULL, 0);
+    strbuf_init(&b->buf, &b->m.alc);
+    luaL_getmetatable(L, BUFFER_MT);
+    lua_setmetatable(L, -2);
+    if (size > 0 && !strbuf_reserve(&b->buf, (size_t)size)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    return 1;
+}
+
+// defined after the direct writer
+static int buffer_encode_lua(lua_State *L);
+
+static inline void init_buffer_mt(lua_State *L)
+{
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       buffer_gc             },
+        {"__len",      buffer_len_lua        },
+        {"__tostring", buffer_tostring_mt_lua},
+        {NULL,         NULL                  }
+    };
+    struct luaL_Reg methods[] = {
+        {"write",    buffer_write_lua   },
+        {"reserve",  buffer_reserve_lua },
+        {"reset",    buffer_reset_lua   },
+        {"tostring", buffer_tostring_lua},
+        {"pointer",  buffer_pointer_lua },
+        {"consume",  buffer_consume_lua },
+        {"encode",   buffer_encode_lua  },
+        {NULL,       NULL               }
+    };
+
+    luaL_newmetatable(L, BUFFER_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_newtable(L);
+    for (struct luaL_Reg *ptr = methods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+#define AS_OBJECT_MT "yyjson.as_object"
+#define AS_ARRAY_MT  "yyjson.as_array"
+#define AS_NULL_MT   "yyjson.null"
+
+static void *AS_OBJECT   = NULL;
+static void *AS_ARRAY    = NULL;
+static void *AS_NULL     = NULL;
+static int AS_OBJECT_REF = LUA_NOREF;
+static int AS_ARRAY_REF  = LUA_NOREF;
+static int AS_NULL_REF   = LUA_NOREF;
+
+// metatables of the tables that are tagged by yyjson.as_array and
+// yyjson.as_object. they are compared by the pointer.
+#define ARRAY_MT  "yyjson.array"
+#define OBJECT_MT "yyjson.object"
+
+static const void *ARRAY_MTPTR  = NULL;
+static const void *OBJECT_MTPTR = NULL;
+
+#define tostring_lua(L, tname)                                                 \
+    do {                                                                       \
+        lauxh_isuserdataof((L), 1, (tname));                                   \
+        lua_pushliteral((L), tname);                                           \
+    } while (0)
+
+static int object_tostring_lua(lua_State *L)
+{
+    tostring_lua(L, AS_OBJECT_MT);
+    return 1;
+}
+
+static int array_tostring_lua(lua_State *L)
+{
+    tostring_lua(L, AS_ARRAY_MT);
+    return 1;
+}
+
+static int null_tostring_lua(lua_State *L)
+{
+    tostring_lua(L, AS_NULL_MT);
+    return 1;
+}
+
+static inline void init_aux_objects(lua_State *L)
+{
+    // create auxiliary object metatables
+    AS_OBJECT = lua_newuserdata(L, 0);
+    luaL_newmetatable(L, AS_OBJECT_MT);
+    lauxh_pushfn2tbl(L, "__tostring", object_tostring_lua);
+    lua_setmetatable(L, -2);
+    AS_OBJECT_REF = lauxh_ref(L);
+
+    AS_ARRAY = lua_newuserdata(L, 0);
+    luaL_newmetatable(L, AS_ARRAY_MT);
+    lauxh_pushfn2tbl(L, "__tostring", array_tostring_lua);
+    lua_setmetatable(L, -2);
+    AS_ARRAY_REF = lauxh_ref(L);
+
+    AS_NULL = lua_newuserdata(L, 0);
+    luaL_newmetatable(L, AS_NULL_MT);
+    lauxh_pushfn2tbl(L, "__tostring", null_tostring_lua);
+    lua_setmetatable(L, -2);
+    AS_NULL_REF = lauxh_ref(L);
+
+    // create the metatables for tagging the tables
+    luaL_newmetatable(L, ARRAY_MT);
+    lua_pushliteral(L, "array");
+    lua_setfield(L, -2, "__jsontype");
+    ARRAY_MTPTR = lua_topointer(L, -1);
+    luaL_newmetatable(L, OBJECT_MT);
+    lua_pushliteral(L, "object");
+    lua_setfield(L, -2, "__jsontype");
+    OBJECT_MTPTR = lua_topointer(L, -1);
+    lua_pop(L, 2);
+}
+
+// set the metatable of the table to tag it as an array or an object. the
+// table that has its own metatable is refused, because replacing it would
+// silently drop the metamethods of the table.
+static int settag_lua(lua_State *L, const char *tname)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    if (lua_getmetatable(L, 1)) {
+        const void *mt = lua_topointer(L, -1);
+        if (mt != ARRAY_MTPTR && mt != OBJECT_MTPTR) {
+            return luaL_argerror(L, 1, "table already has a metatable");
+        }
+        lua_pop(L, 1);
+    }
+    luaL_getmetatable(L, tname);
+    lua_setmetatable(L, 1);
+    return 1;
+}
+
+static int as_array_lua(lua_State *L)
+{
+    return settag_lua(L, ARRAY_MT);
+}
+
+static int as_object_lua(lua_State *L)
+{
+    return settag_lua(L, OBJECT_MT);
+}
+
+#define RAW_MT "yyjson.raw"
+
+// pre-encoded JSON fragment that is written to the output as it is.
+// the string is kept alive by the reference while the marker is alive, or
+// it is stored after the marker itself.
+typedef struct {
+    int ref;
+    const char *str;
+    size_t len;
+} raw_t;
+
+static const void *RAW_MTPTR = NULL;
+
+static int raw_len_lua(lua_State *L)
+{
+    raw_t *r = (raw_t *)luaL_checkudata(L, 1, RAW_MT);
+    lua_pushinteger(L, r->len);
+    return 1;
+}
+
+static int raw_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, RAW_MT ": %p", luaL_checkudata(L, 1, RAW_MT));
+    return 1;
+}
+
+static int raw_gc(lua_State *L)
+{
+    raw_t *r = (raw_t *)lua_touserdata(L, 1);
+    r->ref   = lauxh_unref(L, r->ref);
+    return 0;
+}
+
+static int raw_lua(lua_State *L)
+{
+    size_t len      = 0;
+    const char *str = lauxh_checklstring(L, 1, &len);
+    raw_t *r        = NULL;
+
+    lua_settop(L, 1);
+    r  = (raw_t *)lua_newuserdata(L, sizeof(raw_t));
+    *r = (raw_t){
+        .ref = LUA_NOREF,
+        .str = str,
+        .len = len,
+    };
+    luaL_getmetatable(L, RAW_MT);
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, 1);
+    r->ref = lauxh_ref(L);
+    return 1;
+}
+
+// push a raw value that holds a copy of the string in itself, so it does not
+// need the reference to the string
+static void pushraw(lua_State *L, const char *str, size_t len)
+{
+    raw_t *r  = (raw_t *)lua_newuserdata(L, sizeof(raw_t) + len);
+    char *buf = (char *)(r + 1);
+
+    memcpy(buf, str, len);
+    *r = (raw_t){
+        .ref = LUA_NOREF,
+        .str = buf,
+        .len = len,
+    };
+    luaL_getmetatable(L, RAW_MT);
+    lua_setmetatable(L, -2);
+}
+
+static inline void init_raw_mt(lua_State *L)
+{
+    luaL_newmetatable(L, RAW_MT);
+    lauxh_pushfn2tbl(L, "__gc", raw_gc);
+    lauxh_pushfn2tbl(L, "__len", raw_len_lua);
+    lauxh_pushfn2tbl(L, "__tostring", raw_tostring_lua);
+    RAW_MTPTR = lua_topointer(L, -1);
+    lua_pop(L, 1);
+}
+
+// returns the raw marker at idx, or NULL if the value is not a raw marker.
+// the metatable is compared by the pointer instead of the registry lookup.
+static inline raw_t *toraw(lua_State *L, int idx)
+{
+    raw_t *r = NULL;
+
+    if (lua_getmetatable(L, idx)) {
+        if (lua_topointer(L, -1) == RAW_MTPTR) {
+            r = (raw_t *)lua_touserdata(L, idx);
+        }
+        lua_pop(L, 1);
+    }
+    return r;
+}
+
+#define KEYCACHE_SIZE   256
+#define KEYCACHE_MAXLEN 64
+
+// direct-mapped cache of the object keys that have been pushed during the
+// decoding. the key strings are stored in the table at idx with the slot
+// number, and pushed from that table instead of interning the key bytes again.
+typedef struct {
+    int idx;
+    struct {
+        const char *str;
+        size_t len;
+    } slots[KEYCACHE_SIZE];
+} keycache_t;
+
+static inline void keycache_init(lua_State *L, keycache_t *kc)
+{
+    memset(kc, 0, sizeof(keycache_t));
+    lua_createtable(L, KEYCACHE_SIZE, 0);
+    kc->idx = lua_gettop(L);
+}
+
+typedef struct projnode_s projnode_t;
+
+// node of the path trie of the keep or drop option. the name "*" matches
+// any key or index.
+struct projnode_s {
+    const char *name;
+    size_t len;
+    // the path ends at this node, so the subtree is kept or dropped entirely
+    int leaf;
+    projnode_t *child;
+    projnode_t *next;
+};
+
+// projection of the decoded values. the nodes and their names are stored
+// in the same memory block.
+typedef struct {
+    int keep;
+    projnode_t root;
+    projnode_t nodes[];
+} projection_t;
+
+typedef struct {
+    int with_null;
+    int with_ref;
+    keycache_t *keys;
+    // maximum nesting depth of the containers. 0 means no limit.
+    size_t max_depth;
+    projection_t *proj;
+    // push the raw numbers as strings instead of yyjson.raw values
+    int raw_string;
+    // the raw_number option is specified, so the unsigned integers that do
+    // not fit into lua_Integer are pushed as the raw numbers too
+    int raw_bignum;
+    // error number of the last failure of pushvalue
+    yyjson_read_code code;
+} pushctx_t;
+
+static inline void pushkey(lua_State *L, keycache_t *kc, yyjson_val *key)
+{
+    const char *str = yyjson_get_str(key);
+    size_t len      = yyjson_get_len(key);
+
+    if (kc && len <= KEYCACHE_MAXLEN) {
+        // FNV-1a hash
+        uint32_t hash = 2166136261U;
+        for (size_t i = 0; i < len; i++) {
+            hash = (hash ^ (unsigned char)str[i]) * 16777619U;
+        }
+        hash &= KEYCACHE_SIZE - 1;
+        if (kc->slots[hash].str && kc->slots[hash].len == len &&
+            memcmp(kc->slots[hash].str, str, len) == 0) {
+            lua_rawgeti(L, kc->idx, (int)hash + 1);
+            return;
+        }
+        // replace the slot with the new key
+        lua_pushlstring(L, str, len);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, kc->idx, (int)hash + 1);
+        kc->slots[hash].str = lua_tostring(L, -1);
+        kc->slots[hash].len = len;
+        return;
+    }
+    lua_pushlstring(L, str, len);
+}
+
+// initialize the push context. if the key_cache option of the options table
+// at idx is true, the key cache table is pushed onto the stack.
+// initialize the context with the options table at idx except the key_cache
+// option, so the context can be kept across the calls
+static void pushctx_setup(lua_State *L, pushctx_t *ctx, int idx, int with_null,
+                          int with_ref)
+{
+    static const char *const RAW_NUMBERS[] = {
+        "raw",
+        "string",
+        NULL,
+    };
+
+    ctx->with_null  = with_null;
+    ctx->with_ref   = with_ref;
+    ctx->keys       = NULL;
+    ctx->max_depth  = 0;
+    ctx->proj       = NULL;
+    ctx->raw_string = 0;
+    ctx->raw_bignum = 0;
+    ctx->code       = YYJSON_READ_SUCCESS;
+    if (lua_type(L, idx) == LUA_TTABLE) {
+        int raw = 0;
+
+        if (getoptfield(L, idx, "max_depth", LUA_TNUMBER) != LUA_TNIL) {
+            lua_Integer depth = lua_tointeger(L, -1);
+            ctx->max_depth    = (depth < 0) ? 0 : (size_t)depth;
+        }
+        lua_pop(L, 1);
+        raw = optfield_name(L, idx, "raw_number", RAW_NUMBERS, -1,
+                            "'raw' or 'string'");
+        ctx->raw_string = raw > 0;
+        ctx->raw_bignum = raw >= 0;
+    }
+}
+
+static void pushctx_init(lua_State *L, pushctx_t *ctx, keycache_t *kc, int idx,
+                         int with_null, int with_ref)
+{
+    pushctx_setup(L, ctx, idx, with_null, with_ref);
+    if (optfield_boolean(L, idx, "key_cache", 0)) {
+        keycache_init(L, kc);
+        ctx->keys = kc;
+    }
+}
+
+// push the scalar value. the container value is handled by pushvalue.
+static int pushscalar(lua_State *L, int base, yyjson_val *val,
+                      pushctx_t *ctx)
+{
+    switch (yyjson_get_type(val)) {
+    case YYJSON_TYPE_NULL:
+        if (ctx->with_null) {
+            lauxh_pushref(L, AS_NULL_REF);
+            return 1;
+        }
+    case YYJSON_TYPE_NONE:
+        lua_pushnil(L);
+        return 1;
+
+    case YYJSON_TYPE_BOOL:
+        lua_pushboolean(L, yyjson_get_bool(val));
+        return 1;
+
+    case YYJSON_TYPE_NUM:
+        switch (yyjson_get_subtype(val)) {
+        case YYJSON_SUBTYPE_UINT: {
+            uint64_t uval    = yyjson_get_uint(val);
+            lua_Integer ival = (lua_Integer)uval;
+            if (ival >= 0 && (uint64_t)ival == uval) {
+                lua_pushinteger(L, ival);
+            } else if (ctx->raw_bignum) {
+                // the value that does not fit into lua_Integer is pushed as
+                // the raw number to keep the precision
+                char buf[24];
+                int len = snprintf(buf, sizeof(buf), "%" PRIu64, uval);
+                if (ctx->raw_string) {
+                    lua_pushlstring(L, buf, (size_t)len);
+                } else {
+                    pushraw(L, buf, (size_t)len);
+                }
+            } else {
+                // otherwise it is pushed as a float instead of wrapping
+                // around
+                lua_pushnumber(L, (lua_Number)uval);
+            }
+            break;
+        }
+        case YYJSON_SUBTYPE_SINT:
+            lua_pushinteger(L, yyjson_get_sint(val));
+            break;
+        case YYJSON_SUBTYPE_REAL:
+            lua_pushnumber(L, yyjson_get_real(val));
+            break;
+        }
+        return 1;
+
+    case YYJSON_TYPE_STR:
+        lua_pushlstring(L, yyjson_get_str(val), yyjson_get_len(val));
+        return 1;
+
+    case YYJSON_TYPE_RAW:
+        // the number that is read by READ_NUMBER_AS_RAW or READ_BIGNUM_AS_RAW
+        if (ctx->raw_string) {
+            lua_pushlstring(L, yyjson_get_raw(val), yyjson_get_len(val));
+        } else {
+            pushraw(L, yyjson_get_raw(val), yyjson_get_len(val));
+        }
+        return 1;
+
+    default:
+        // unknown type
+        ctx->code = YYJSON_READ_ERROR_UNEXPECTED_CONTENT;
+        lua_settop(L, base);
+        lua_pushnil(L);
+        lua_pushfstring(L, "unknown value type %d", yyjson_get_type(val));
+        return 2;
+    }
+}
+
+#define PUSHFRAME_NSTACK 32
+
+// iteration state of the container that is being pushed. the table of the
+// container is on the Lua stack in the same order as the frames.
+typedef struct {
+    int obj;
+    union {
+        yyjson_arr_iter arr;
+        yyjson_obj_iter obj;
+    } it;
+    // node of the projection, or NULL if the container is not filtered
+    projnode_t *node;
+} pushframe_t;
+
+static inline void pushframe(lua_State *L, pushframe_t *f, yyjson_val *val,
+                             pushctx_t *ctx)
+{
+    f->node = NULL;
+    if ((f->obj = yyjson_is_obj(val))) {
+        yyjson_obj_iter_init(val, &f->it.obj);
+        lua_createtable(L, 0, f->it.obj.max);
+        if (ctx->with_ref) {
+            lauxh_pushref(L, AS_OBJECT_REF);
+            lua_rawseti(L, -2, -1);
+        }
+    } else {
+        yyjson_arr_iter_init(val, &f->it.arr);
+        lua_createtable(L, f->it.arr.max, 0);
+        if (ctx->with_ref) {
+            lauxh_pushref(L, AS_ARRAY_REF);
+            lua_rawseti(L, -2, -1);
+        }
+    }
+}
+
+// set the value on the top of the stack to the container of the frame.
+static inline void setframe(lua_State *L, pushframe_t *f)
+{
+    if (f->obj) {
+        lua_rawset(L, -3);
+    } else {
+        lua_rawseti(L, -2, f->it.arr.idx);
+    }
+}
+
+// find or add the child node of the token. the token is unescaped into the
+// names buffer if it is a JSON Pointer token.
+static projnode_t *projection_child(projection_t *p, size_t *nnode,
+                                    char **names, projnode_t *parent,
+                                    const char *tok, size_t len, int unescape)
+{
+    char *name    = *names;
+    size_t n      = 0;
+    projnode_t *c = NULL;
+
+    for (size_t i = 0; i < len; i++) {
+        if (unescape && tok[i] == '~' && i + 1 < len &&
+            (tok[i + 1] == '0' || tok[i + 1] == '1')) {
+            name[n++] = (tok[++i] == '0') ? '~' : '/';
+        } else {
+            name[n++] = tok[i];
+        }
+    }
+    for (c = parent->child; c; c = c->next) {
+        if (c->len == n && memcmp(c->name, name, n) == 0) {
+            return c;
+        }
+    }
+    c  = &p->nodes[(*nnode)++];
+    *c = (projnode_t){
+        .name = name,
+        .len  = n,
+        .next = parent->child,
+    };
+    parent->child = c;
+    *names += n;
+    return c;
+}
+
+// add the path that is either a JSON Pointer or a top-level key
+static void projection_add(projection_t *p, size_t *nnode, char **names,
+                           const char *path, size_t len)
+{
+    projnode_t *node = &p->root;
+    const char *end  = path + len;
+    const char *ptr  = path;
+
+    if (len && *path != '/') {
+        node = projection_child(p, nnode, names, node, path, len, 0);
+    } else {
+        while (ptr < end && !node->leaf) {
+            const char *tok = ++ptr;
+            while (ptr < end && *ptr != '/') {
+                ptr++;
+            }
+            node = projection_child(p, nnode, names, node, tok,
+                                    (size_t)(ptr - tok), 1);
+        }
+    }
+    node->leaf = 1;
+}
+
+// compile the keep or drop option of the options table at idx, and push it
+// onto the stack. returns 0 if neither option is specified.
+static int pushprojection(lua_State *L, pushctx_t *ctx, int idx)
+{
+    const char *opt = NULL;
+    projection_t *p = NULL;
+    size_t nnode    = 0;
+    size_t nbyte    = 0;
+    char *names     = NULL;
+    int keep        = 0;
+    int list        = 0;
+    size_t n        = 0;
+
+    if (lua_type(L, idx) != LUA_TTABLE) {
+        return 0;
+    }
+    keep = getoptfield(L, idx, "keep", LUA_TTABLE) != LUA_TNIL;
+    if (getoptfield(L, idx, "drop", LUA_TTABLE) != LUA_TNIL) {
+        if (keep) {
+            luaL_argerror(L, idx, "keep and drop cannot be used together");
+        }
+        lua_remove(L, -2);
+    } else if (keep) {
+        lua_pop(L, 1);
+    } else {
+        lua_pop(L, 2);
+        return 0;
+    }
+    opt  = (keep) ? "keep" : "drop";
+    list = lua_gettop(L);
+
+    // count the tokens and the bytes of the paths
+    n = lauxh_rawlen(L, list);
+    for (size_t i = 1; i <= n; i++) {
+        size_t len       = 0;
+        const char *path = NULL;
+
+        lua_rawgeti(L, list, i);
+        if (lua_type(L, -1) != LUA_TSTRING) {
+            lua_pushfstring(L, "%s #%d must be string", opt, (int)i);
+            luaL_argerror(L, idx, lua_tostring(L, -1));
+        }
+        path = lua_tolstring(L, -1, &len);
+        nnode++;
+        if (len && *path == '/') {
+            for (size_t j = 1; j < len; j++) {
+                nnode += path[j] == '/';
+            }
+        }
+        nbyte += len;
+        lua_pop(L, 1);
+    }
+
+    p = (projection_t *)lua_newuserdata(L, sizeof(projection_t) +
+                                               sizeof(projnode_t) * nnode +
+                                               nbyte);
+    p->keep = keep;
+    p->root = (projnode_t){0};
+    names   = (char *)(p->nodes + nnode);
+    nnode   = 0;
+    for (size_t i = 1; i <= n; i++) {
+        size_t len       = 0;
+        const char *path = NULL;
+
+        lua_rawgeti(L, list, i);
+        path = lua_tolstring(L, -1, &len);
+        projection_add(p, &nnode, &names, path, len);
+        lua_pop(L, 1);
+    }
+    lua_remove(L, list);
+    ctx->proj = p;
+    return 1;
+}
+
+// decide whether the child value of the node is pushed. *child is set to the
+// node of the child value, or NULL if the value is not filtered.
+static int projection_match(projection_t *p, projnode_t *node,
+                            const char *key, size_t len, yyjson_val *val,
+                            projnode_t **child)
+{
+    projnode_t *any = NULL;
+    projnode_t *c   = NULL;
+
+    for (c = node->child; c; c = c->next) {
+        if (c->len == len && memcmp(c->name, key, len) == 0) {
+            break;
+        } else if (c->len == 1 && *c->name == '*') {
+            any = c;
+        }
+    }
+    if (!c) {
+        c = any;
+    }
+
+    *child = NULL;
+    if (p->keep) {
+        // the scalar value is not kept if the path goes through it
+        if (!c || (!c->leaf && !yyjson_is_ctn(val))) {
+            return 0;
+        } else if (!c->leaf) {
+            *child = c;
+        }
+    } else if (c) {
+        if (c->leaf) {
+            return 0;
+        }
+        *child = c;
+    }
+    return 1;
+}
+
+// push the value without recursion. the containers are traversed with the
+// explicit frame stack, and the Lua stack slots are reserved each time the
+// frame stack grows, not for each nesting level.
+// the frame stack that outgrows PUSHFRAME_NSTACK is allocated as a userdata
+// and kept below the root table, so it is released even if a Lua error is
+// raised while pushing the values.
+static int pushvalue(lua_State *L, int base, yyjson_val *val, pushctx_t *ctx)
+{
+    pushframe_t stack[PUSHFRAME_NSTACK];
+    pushframe_t *frames   = stack;
+    size_t cap            = PUSHFRAME_NSTACK;
+    size_t depth          = 0;
+    const char *errmsg    = NULL;
+    // the failure other than the depth limit is the lack of the stack space
+    yyjson_read_code code = YYJSON_READ_ERROR_MEMORY_ALLOCATION;
+    int top               = lua_gettop(L);
+    int rc                = 0;
+
+    if (!yyjson_is_ctn(val)) {
+        return pushscalar(L, base, val, ctx);
+    }
+
+    // a frame holds the table and the key on the stack
+    if (!lua_checkstack(L, PUSHFRAME_NSTACK * 2 + 2)) {
+        errmsg = "out of stack space";
+        goto FAIL;
+    }
+    pushframe(L, frames, val, ctx);
+    if (ctx->proj) {
+        if (!ctx->proj->root.leaf) {
+            frames->node = &ctx->proj->root;
+        } else if (!ctx->proj->keep) {
+            // the whole document is dropped
+            lua_pop(L, 1);
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+    depth = 1;
+    while (depth) {
+        pushframe_t *f   = &frames[depth - 1];
+        projnode_t *node = NULL;
+
+        if (f->obj) {
+            yyjson_val *key = yyjson_obj_iter_next(&f->it.obj);
+            if (key) {
+                val = yyjson_obj_iter_get_val(key);
+                // the key of the skipped value is never pushed
+                if (f->node &&
+                    !projection_match(ctx->proj, f->node, yyjson_get_str(key),
+                                      yyjson_get_len(key), val, &node)) {
+                    continue;
+                }
+                pushkey(L, ctx->keys, key);
+            } else {
+                val = NULL;
+            }
+        } else if ((val = yyjson_arr_iter_next(&f->it.arr)) && f->node) {
+            // match the index of the JSON Pointer that starts from 0
+            char idx[24];
+            int len = snprintf(idx, sizeof(idx), "%zu", f->it.arr.idx - 1);
+            if (!projection_match(ctx->proj, f->node, idx, (size_t)len, val,
+                                  &node)) {
+                continue;
+            }
+        }
+
+        if (!val) {
+            // set the finished container to the parent
+            if (--depth) {
+                setframe(L, &frames[depth - 1]);
+            }
+        } else if (!yyjson_is_ctn(val)) {
+            if ((rc = pushscalar(L, base, val, ctx)) > 1) {
+                // the stack is already reset to the base
+                return rc;
+            }
+            setframe(L, f);
+        } else if (ctx->max_depth && depth >= ctx->max_depth) {
+            errmsg = "exceeded the maximum depth";
+            code   = YYJSON_READ_ERROR_JSON_STRUCTURE;
+            goto FAIL;
+        } else {
+            if (depth == cap) {
+                // grow the frame stack and reserve the stack slots for it
+                pushframe_t *newframes = NULL;
+                if (cap > (size_t)INT_MAX / 4 ||
+                    !lua_checkstack(L, (int)cap * 2 + 1)) {
+                    errmsg = "out of stack space";
+                    goto FAIL;
+                }
+                newframes = (pushframe_t *)lua_newuserdata(
+                    L, sizeof(pushframe_t) * cap * 2);
+                memcpy(newframes, frames, sizeof(pushframe_t) * cap);
+                if (frames == stack) {
+                    lua_insert(L, top + 1);
+                } else {
+                    // the old frames are released by the garbage collector
+                    lua_replace(L, top + 1);
+                }
+                frames = newframes;
+                cap *= 2;
+            }
+            pushframe(L, &frames[depth], val, ctx);
+            frames[depth].node = node;
+            depth++;
+        }
+    }
+    if (frames != stack) {
+        // remove the frames below the root table
+        lua_remove(L, top + 1);
+    }
+    return 1;
+
+FAIL:
+    ctx->code = code;
+    lua_settop(L, base);
+    lua_pushnil(L);
+    lua_pushstring(L, errmsg);
+    return 2;
+}
+
+// push the root value of the document and the read size, or the error of the
+// reader. the document will be released.
+static int pushdoc(lua_State *L, int base, yyjson_doc *doc,
+                   yyjson_read_err *err, pushctx_t *ctx)
+{
+    int rc = 3;
+
+    if (doc) {
+        rc = pushvalue(L, base, yyjson_doc_get_root(doc), ctx);
+        if (rc == 1) {
+            lua_pushnil(L);
+            lua_pushnil(L);
+            lua_pushinteger(L, yyjson_doc_get_read_size(doc));
+            rc = 4;
+        }
+        yyjson_doc_free(doc);
+    } else {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s at %d", err->msg, err->pos);
+        lua_pushinteger(L, err->code);
+    }
+    return rc;
+}
+
+static int decode_call(lua_State *L)
+{
+    size_t len           = 0;
+    char *str            = NULL;
+    buffer_t *b          = NULL;
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    yyjson_read_err err  = {0};
+    yyjson_doc *doc      = NULL;
+    memalloc_t m         = {0};
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    statsreg_t *reg      = stats_get(L);
+    double t0            = 0;
+    double t1            = 0;
+    int rc               = 0;
+
+    if (lauxh_isuserdataof(L, 1, BUFFER_MT)) {
+        // the buffer is owned by this module, so it can be parsed in-situ.
+        // but with READ_STOP_WHEN_DONE, the buffer may contain a partial
+        // document that is completed by the next write, so it is parsed from
+        // a copy to keep the content intact on failure.
+        b   = (buffer_t *)lua_touserdata(L, 1);
+        len = b->buf.len;
+        if (flg & YYJSON_READ_STOP_WHEN_DONE) {
+            flg &= ~YYJSON_READ_INSITU;
+        } else {
+            flg |= YYJSON_READ_INSITU;
+        }
+        if (!(str = strbuf_padded(&b->buf))) {
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(ENOMEM));
+            lua_pushinteger(L, YYJSON_READ_ERROR_MEMORY_ALLOCATION);
+            return 3;
+        }
+    } else {
+        str = (char *)lauxh_checklstring(L, 1, &len);
+        if (flg & YYJSON_READ_INSITU) {
+            // Lua strings are immutable and may be shared, so they are never
+            // parsed in-situ. the padding bytes are ignored.
+            len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+            flg &= ~YYJSON_READ_INSITU;
+        }
+    }
+
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 4);
+    // the options are parsed before the arena is acquired, so that the
+    // argument errors never leave the arena in use
+    pushctx_init(L, &ctx, &kc, 4, with_null, with_ref);
+    pushprojection(L, &ctx, 4);
+    memalloc_init(&m, L, 4);
+    t0  = stats_clock(reg);
+    doc = yyjson_read_opts(str, len, flg, &m.alc, &err);
+    t1  = stats_clock(reg);
+    if (b && doc) {
+        // remove the decoded bytes from the buffer
+        size_t n = yyjson_doc_get_read_size(doc);
+        rc       = pushdoc(L, lua_gettop(L), doc, &err, &ctx);
+        strbuf_consume(&b->buf, n);
+    } else {
+        rc = pushdoc(L, lua_gettop(L), doc, &err, &ctx);
+        if (b && (flg & YYJSON_READ_INSITU)) {
+            // the content was partially modified by the failed parse, even
+            // if the document is only incomplete. it cannot be restored
+            // without the copy that READ_STOP_WHEN_DONE makes.
+            b->buf.len = 0;
+        }
+    }
+    stats_record(&reg->decode, &m, t1 - t0, stats_clock(reg) - t1);
+    memalloc_dispose(&m);
+
+    return rc;
+}
+
+static int decode_lua(lua_State *L)
+{
+    return arena_call(L, 4, decode_call);
+}
+
+static FILE *checkfile(lua_State *L, int idx)
+{
+#if LUA_VERSION_NUM >= 502
+    luaL_Stream *p = (luaL_Stream *)luaL_checkudata(L, idx, LUA_FILEHANDLE);
+    if (!p->closef) {
+        luaL_argerror(L, idx, "attempt to use a closed file");
+    }
+    return p->f;
+#else
+    FILE **p = (FILE **)luaL_checkudata(L, idx, LUA_FILEHANDLE);
+    if (!*p) {
+        luaL_argerror(L, idx, "attempt to use a closed file");
+    }
+    return *p;
+#endif
+}
+
+// parse the file in-situ over the private memory mapping.
+// the mapping is followed by the zero-filled anonymous pages for the padding
+// bytes, so the file content will never be copied to the heap.
+static int decode_mmap(lua_State *L, const char *path, yyjson_read_flag flg,
+                       memalloc_t *m, pushctx_t *ctx)
+{
+    yyjson_read_err err = {0};
+    yyjson_doc *doc     = NULL;
+    struct stat st      = {0};
+    size_t pagesize     = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len          = 0;
+    size_t mlen         = 0;
+    char *map           = NULL;
+    int fd              = open(path, O_RDONLY);
+    int rc              = 3;
+
+    if (fd == -1) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, strerror(errno));
+        lua_pushinteger(L, YYJSON_READ_ERROR_FILE_OPEN);
+        return 3;
+    } else if (fstat(fd, &st) == -1) {
+        goto FAIL_READ;
+    }
+
+    len  = (size_t)st.st_size;
+    mlen = (len + YYJSON_PADDING_SIZE + pagesize - 1) / pagesize * pagesize;
+    map  = mmap(NULL, mlen, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        goto FAIL_READ;
+    } else if (len && mmap(map, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(map, mlen);
+FAIL_READ:
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, strerror(errno));
+        lua_pushinteger(L, YYJSON_READ_ERROR_FILE_READ);
+        close(fd);
+        return 3;
+    }
+    close(fd);
+
+    doc = yyjson_read_opts(map, len, flg, &m->alc, &err);
+    rc  = pushdoc(L, lua_gettop(L), doc, &err, ctx);
+    munmap(map, mlen);
+
+    return rc;
+}
+
+static int decode_file_call(lua_State *L)
+{
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    yyjson_read_err err  = {0};
+    yyjson_doc *doc      = NULL;
+    const char *path     = NULL;
+    FILE *fp             = NULL;
+    memalloc_t m         = {0};
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    statsreg_t *reg      = stats_get(L);
+    double t0            = 0;
+    double t1            = 0;
+    int rc               = 0;
+
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        path = lua_tostring(L, 1);
+    } else {
+        fp = checkfile(L, 1);
+    }
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 4);
+    // the options are parsed before the arena is acquired, so that the
+    // argument errors never leave the arena in use
+    pushctx_init(L, &ctx, &kc, 4, with_null, with_ref);
+    pushprojection(L, &ctx, 4);
+    memalloc_init(&m, L, 4);
+    t0 = stats_clock(reg);
+    if (path && (flg & YYJSON_READ_INSITU)) {
+        // the mapped file is parsed and pushed at once, so the whole time is
+        // counted as the parse time
+        rc = decode_mmap(L, path, flg, &m, &ctx);
+        t1 = stats_clock(reg);
+    } else {
+        // the file content is read into the buffer that is allocated by the
+        // allocator and parsed in-situ by yyjson
+        flg &= ~YYJSON_READ_INSITU;
+        if (path) {
+            doc = yyjson_read_file(path, flg, &m.alc, &err);
+        } else {
+            doc = yyjson_read_fp(fp, flg, &m.alc, &err);
+        }
+        t1 = stats_clock(reg);
+        rc = pushdoc(L, lua_gettop(L), doc, &err, &ctx);
+    }
+    stats_record(&reg->decode, &m, t1 - t0, stats_clock(reg) - t1);
+    memalloc_dispose(&m);
+
+    return rc;
+}
+
+static int decode_file_lua(lua_State *L)
+{
+    return arena_call(L, 4, decode_file_call);
+}
+
+// push the arena that is specified by the mlimit argument at idx, or the new
+// internal arena that is limited by the mlimit. returns 0 if failed to create
+// the internal arena.
+static int pusharena(lua_State *L, int idx)
+{
+    lua_Integer maxsize = 0;
+
+    if (lauxh_isuserdataof(L, idx, ARENA_MT)) {
+        lua_pushvalue(L, idx);
+        return 1;
+    } else if (lua_type(L, idx) == LUA_TTABLE) {
+        // use the arena or mlimit of the options table
+        lua_getfield(L, idx, "arena");
+        if (!lua_isnil(L, -1)) {
+            if (!lauxh_isuserdataof(L, -1, ARENA_MT)) {
+                luaL_argerror(L, idx, "arena must be yyjson.arena");
+            }
+            return 1;
+        }
+        lua_pop(L, 1);
+        if (getoptfield(L, idx, "mlimit", LUA_TNUMBER) != LUA_TNIL) {
+            maxsize = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+    } else {
+        maxsize = lauxh_optinteger(L, idx, 0);
+    }
+    return newarena(L, 0, (maxsize < 0) ? 0 : (size_t)maxsize) != NULL;
+}
+
+// the input string is copied into the padded data once, and parsed in-situ.
+// otherwise yyjson makes a copy of the remaining input for each record.
+typedef struct {
+    size_t pos;
+    pushctx_t ctx;
+    keycache_t kc;
+    yyjson_read_flag flg;
+    int done;
+    size_t len;
+    char data[];
+} decode_iter_t;
+
+static int decode_iter_call(lua_State *L)
+{
+    decode_iter_t *s = (decode_iter_t *)lua_touserdata(L, lua_upvalueindex(1));
+    yyjson_read_err err = {0};
+    yyjson_doc *doc     = NULL;
+    memalloc_t m        = {0};
+    int rc              = 1;
+
+    lua_settop(L, 0);
+    if (s->done || s->pos >= s->len) {
+        s->done = 1;
+        lua_pushnil(L);
+        return 1;
+    }
+
+    memalloc_init(&m, L, lua_upvalueindex(3));
+    doc = yyjson_read_opts(s->data + s->pos, s->len - s->pos, s->flg, &m.alc,
+                           &err);
+    if (!doc) {
+        s->done = 1;
+        if (err.code == YYJSON_READ_ERROR_EMPTY_CONTENT) {
+            // only whitespace remains
+            lua_pushnil(L);
+        } else {
+            lua_pushboolean(L, 0);
+            lua_pushfstring(L, "%s at %d", err.msg, (int)(s->pos + err.pos));
+            lua_pushinteger(L, err.code);
+            rc = 3;
+        }
+    } else {
+        s->pos += yyjson_doc_get_read_size(doc);
+        rc = pushvalue(L, 0, yyjson_doc_get_root(doc), &s->ctx);
+        if (rc == 1) {
+            lua_pushinteger(L, s->pos);
+            lua_insert(L, 1);
+            rc = 2;
+        } else {
+            // replace nil with false to notify an error
+            s->done = 1;
+            lua_pushboolean(L, 0);
+            lua_replace(L, 1);
+        }
+        yyjson_doc_free(doc);
+    }
+    memalloc_dispose(&m);
+
+    return rc;
+}
+
+// the upvalues are the closure of decode_iter_call and the arena
+static int decode_iter_next_lua(lua_State *L)
+{
+    arena_t *a = (arena_t *)lua_touserdata(L, lua_upvalueindex(2));
+
+    lua_settop(L, 0);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    if (a->busy) {
+        // memalloc_init raises the error of the busy arena
+        lua_call(L, 0, LUA_MULTRET);
+        return lua_gettop(L);
+    }
+    return arena_pcall(L, a);
+}
+
+static int decode_iter_lua(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    decode_iter_t *s     = NULL;
+
+    // the padding bytes of the input string are ignored
+    if (flg & YYJSON_READ_INSITU) {
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+    }
+    lua_settop(L, 4);
+
+    s = (decode_iter_t *)lua_newuserdata(L, sizeof(decode_iter_t) + len +
+                                                YYJSON_PADDING_SIZE);
+    s->pos  = 0;
+    s->flg  = flg | YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE;
+    s->done = 0;
+    s->len  = len;
+    memcpy(s->data, str, len);
+    memset(s->data + len, 0, YYJSON_PADDING_SIZE);
+    lua_replace(L, 1);
+    // the key cache table is kept as the upvalue across the records
+    pushctx_init(L, &s->ctx, &s->kc, 4, with_null, with_ref);
+    if (s->ctx.keys) {
+        s->kc.idx = lua_upvalueindex(2);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_replace(L, 2);
+
+    // use the internal arena to reuse the memory across the records
+    if (!pusharena(L, 4)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    lua_replace(L, 3);
+    // the projection is kept as the upvalue
+    if (!pushprojection(L, &s->ctx, 4)) {
+        lua_pushnil(L);
+    }
+    lua_replace(L, 4);
+    lua_settop(L, 4);
+
+    lua_pushcclosure(L, decode_iter_call, 4);
+    lua_pushvalue(L, 3);
+    lua_pushcclosure(L, decode_iter_next_lua, 2);
+    return 1;
+}
+
+// record the error message and the error number at the top of the stack to
+// the errors table at idx as errs[i] = { err, errno }
+static void seterror(lua_State *L, int idx, size_t i)
+{
+    if (lua_isnil(L, idx)) {
+        lua_newtable(L);
+        lua_replace(L, idx);
+    }
+    lua_createtable(L, 2, 0);
+    lua_insert(L, -3);
+    lua_rawseti(L, -3, 2);
+    lua_rawseti(L, -2, 1);
+    lua_rawseti(L, idx, i);
+}
+
+static int decode_many_call(lua_State *L)
+{
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    size_t n             = 0;
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    statsreg_t *reg      = stats_get(L);
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = lauxh_rawlen(L, 1);
+    lua_settop(L, 4);
+    // the memory of the internal arena is reused across the values
+    if (!pusharena(L, 4)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    lua_replace(L, 3);
+    pushctx_init(L, &ctx, &kc, 4, with_null, with_ref);
+    pushprojection(L, &ctx, 4);
+    lua_createtable(L, (int)n, 0);
+    lua_replace(L, 2);
+    // the errors table is created when the first error occurs
+    lua_pushnil(L);
+    lua_replace(L, 4);
+
+    for (size_t i = 1; i <= n; i++) {
+        int base            = lua_gettop(L);
+        yyjson_read_flag f  = flg;
+        yyjson_read_err err = {0};
+        yyjson_doc *doc     = NULL;
+        memalloc_t m        = {0};
+        size_t len          = 0;
+        char *str           = NULL;
+        double t0           = 0;
+        double t1           = 0;
+
+        lua_rawgeti(L, 1, i);
+        if (lua_type(L, -1) != LUA_TSTRING) {
+            lua_pushfstring(L, "string expected, got %s", luaL_typename(L, -1));
+            lua_pushinteger(L, YYJSON_READ_ERROR_INVALID_PARAMETER);
+            seterror(L, 4, i);
+            lua_settop(L, base);
+            continue;
+        }
+        str = (char *)lua_tolstring(L, -1, &len);
+        if (f & YYJSON_READ_INSITU) {
+            // Lua strings are never parsed in-situ
+            len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+            f &= ~YYJSON_READ_INSITU;
+        }
+        memalloc_init(&m, L, 3);
+        t0  = stats_clock(reg);
+        doc = yyjson_read_opts(str, len, f, &m.alc, &err);
+        t1  = stats_clock(reg);
+        switch (pushdoc(L, base + 1, doc, &err, &ctx)) {
+        case 4:
+            lua_settop(L, base + 2);
+            lua_rawseti(L, 2, i);
+            break;
+        case 2:
+            // failed to push the value
+            lua_pushinteger(L, ctx.code);
+        default:
+            seterror(L, 4, i);
+        }
+        // each string is counted as a call
+        stats_record(&reg->decode, &m, t1 - t0, stats_clock(reg) - t1);
+        memalloc_dispose(&m);
+        lua_settop(L, base);
+    }
+    lua_settop(L, 4);
+    lua_replace(L, 3);
+
+    return 2;
+}
+
+static int decode_many_lua(lua_State *L)
+{
+    return arena_call(L, 4, decode_many_call);
+}
+
+#define PARALLEL_MAX_THREADS 64
+// inputs that are smaller than this size per thread are not split by default
+#define PARALLEL_MIN_CHUNK   65536
+
+// lua_Alloc compatible function of the libc allocator.
+// the worker threads cannot use the allocator of the Lua state.
+static void *libc_allocf(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    (void)ud;
+    (void)osize;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+static inline size_t skipws(const char *str, size_t pos, size_t len)
+{
+    while (pos < len && (str[pos] == ' ' || str[pos] == '\t' ||
+                         str[pos] == '\n' || str[pos] == '\r')) {
+        pos++;
+    }
+    return pos;
+}
+
+// range of the input that is parsed by a worker thread.
+// the range is copied into the padded data and parsed in-situ, so the docs
+// refer to the data until they are pushed onto the stack.
+typedef struct {
+    memalloc_t m;
+    const char *src;
+    size_t offset;
+    size_t len;
+    char *data;
+    yyjson_read_flag flg;
+    // the range is the elements of an array that follow the separator, and
+    // that are followed by the separator of the next range
+    int array;
+    int follow;
+    int more;
+    yyjson_doc **docs;
+    size_t ndoc;
+    size_t cap;
+    yyjson_read_err err;
+    size_t errpos;
+    pthread_t tid;
+    int joinable;
+} pchunk_t;
+
+static void pchunk_error(pchunk_t *c, yyjson_read_code code, const char *msg,
+                         size_t pos)
+{
+    c->err.code = code;
+    c->err.msg  = msg;
+    c->errpos   = c->offset + pos;
+}
+
+static void *pchunk_run(void *arg)
+{
+    pchunk_t *c           = (pchunk_t *)arg;
+    const yyjson_alc *alc = &c->m.alc;
+    size_t pos            = 0;
+    int expect            = 0;
+
+    if (!(c->data = (char *)alc->malloc(alc->ctx,
+                                        c->len + YYJSON_PADDING_SIZE))) {
+        pchunk_error(c, YYJSON_READ_ERROR_MEMORY_ALLOCATION,
+                     "memory allocation failed", 0);
+        return NULL;
+    }
+    memcpy(c->data, c->src + c->offset, c->len);
+    memset(c->data + c->len, 0, YYJSON_PADDING_SIZE);
+
+    // the chunk that follows the separator must start with an element
+    expect = c->follow;
+    while ((pos = skipws(c->data, pos, c->len)) < c->len) {
+        yyjson_doc *doc = NULL;
+
+        if (c->array && c->ndoc) {
+            // the elements are separated by a comma
+            if (c->data[pos] != ',') {
+                pchunk_error(c, YYJSON_READ_ERROR_UNEXPECTED_CHARACTER,
+                             "unexpected character, expected a comma", pos);
+                return NULL;
+            }
+            expect = 1;
+            if ((pos = skipws(c->data, pos + 1, c->len)) >= c->len) {
+                break;
+            }
+        }
+        if (c->ndoc == c->cap) {
+            size_t cap = (c->cap) ? c->cap * 2 : 64;
+            void *docs = NULL;
+
+            if (!c->docs) {
+                docs = alc->malloc(alc->ctx, sizeof(yyjson_doc *) * cap);
+            } else {
+                docs = alc->realloc(alc->ctx, c->docs,
+                                    sizeof(yyjson_doc *) * c->cap,
+                                    sizeof(yyjson_doc *) * cap);
+            }
+            if (!docs) {
+                pchunk_error(c, YYJSON_READ_ERROR_MEMORY_ALLOCATION,
+                             "memory allocation failed", pos);
+                return NULL;
+            }
+            c->docs = (yyjson_doc **)docs;
+            c->cap  = cap;
+        }
+        doc = yyjson_read_opts(c->data + pos, c->len - pos, c->flg, alc,
+                               &c->err);
+        if (!doc) {
+            c->errpos = c->offset + pos + c->err.pos;
+            return NULL;
+        }
+        c->docs[c->ndoc++] = doc;
+        pos += yyjson_doc_get_read_size(doc);
+        expect = 0;
+    }
+
+    if (c->array && expect) {
+        if (c->more) {
+            // the separator of the next range follows a comma, so there is
+            // an empty element before it
+            pchunk_error(c, YYJSON_READ_ERROR_UNEXPECTED_CHARACTER,
+                         "unexpected character, expected a value", c->len);
+        } else if (!(c->flg & YYJSON_READ_ALLOW_TRAILING_COMMAS)) {
+            pchunk_error(c, YYJSON_READ_ERROR_JSON_STRUCTURE,
+                         "trailing comma is not allowed", c->len);
+        }
+    }
+    return NULL;
+}
+
+// split the lines of the input into at most n chunks at the newlines
+static size_t split_lines(pchunk_t *chunks, size_t n, const char *str,
+                          size_t len)
+{
+    size_t step   = len / n + 1;
+    size_t head   = 0;
+    size_t nchunk = 0;
+
+    while (head < len) {
+        size_t tail = head + step;
+        if (nchunk + 1 == n || tail >= len) {
+            tail = len;
+        } else {
+            const char *nl = memchr(str + tail, '\n', len - tail);
+            tail           = (nl) ? (size_t)(nl - str) + 1 : len;
+        }
+        chunks[nchunk].offset = head;
+        chunks[nchunk].len    = tail - head;
+        nchunk++;
+        head = tail;
+    }
+    return nchunk;
+}
+
+// split the elements of the top-level array into at most n chunks at the
+// separators. the elements are validated by the worker threads, so this only
+// tracks the strings and the nesting depth. returns 0 on failure.
+static size_t split_array(pchunk_t *chunks, size_t n, const char *str,
+                          size_t len, yyjson_read_err *err)
+{
+    size_t pos    = skipws(str, 0, len);
+    size_t depth  = 1;
+    size_t nchunk = 0;
+    size_t step   = 0;
+
+    if (pos >= len) {
+        err->code = YYJSON_READ_ERROR_EMPTY_CONTENT;
+        err->msg  = "input data is empty";
+        err->pos  = pos;
+        return 0;
+    } else if (str[pos] != '[') {
+        err->code = YYJSON_READ_ERROR_UNEXPECTED_CHARACTER;
+        err->msg  = "unexpected character, expected an array";
+        err->pos  = pos;
+        return 0;
+    }
+
+    step             = (len - pos) / n + 1;
+    chunks[0].offset = pos + 1;
+    for (pos++; pos < len; pos++) {
+        switch (str[pos]) {
+        case '"':
+            // skip the string
+            for (pos++; pos < len && str[pos] != '"'; pos++) {
+                if (str[pos] == '\\') {
+                    pos++;
+                }
+            }
+            break;
+
+        case '[':
+        case '{':
+            depth++;
+            break;
+
+        case ']':
+        case '}':
+            if (--depth > 0) {
+                break;
+            } else if (str[pos] != ']') {
+                err->code = YYJSON_READ_ERROR_UNEXPECTED_CHARACTER;
+                err->msg  = "unexpected character";
+                err->pos  = pos;
+                return 0;
+            } else if (skipws(str, pos + 1, len) < len) {
+                err->code = YYJSON_READ_ERROR_UNEXPECTED_CONTENT;
+                err->msg  = "unexpected content after document";
+                err->pos  = skipws(str, pos + 1, len);
+                return 0;
+            }
+            chunks[nchunk].len = pos - chunks[nchunk].offset;
+            return nchunk + 1;
+
+        case ',':
+            if (depth == 1 && nchunk + 1 < n &&
+                pos - chunks[nchunk].offset >= step) {
+                chunks[nchunk].len  = pos - chunks[nchunk].offset;
+                chunks[nchunk].more = 1;
+                nchunk++;
+                chunks[nchunk].offset = pos + 1;
+                chunks[nchunk].follow = 1;
+            }
+            break;
+        }
+    }
+
+    err->code = YYJSON_READ_ERROR_UNEXPECTED_END;
+    err->msg  = "unexpected end of data";
+    err->pos  = len;
+    return 0;
+}
+
+static void pchunk_free(pchunk_t *c)
+{
+    const yyjson_alc *alc = &c->m.alc;
+
+    for (size_t i = 0; i < c->ndoc; i++) {
+        yyjson_doc_free(c->docs[i]);
+    }
+    if (c->docs) {
+        alc->free(alc->ctx, c->docs);
+    }
+    if (c->data) {
+        alc->free(alc->ctx, c->data);
+    }
+    memalloc_dispose(&c->m);
+}
+
+// decode the records of a NDJSON, or the elements of a top-level array in
+// parallel. the Lua state is used only by the calling thread.
+static int decode_parallel_lua(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    int array            = optfield_boolean(L, 4, "array", 0);
+    long nthread         = sysconf(_SC_NPROCESSORS_ONLN);
+    lua_Integer maxsize  = 0;
+    lua_Integer minchunk = PARALLEL_MIN_CHUNK;
+    yyjson_read_err err  = {0};
+    pchunk_t *chunks     = NULL;
+    size_t nchunk        = 0;
+    size_t nval          = 0;
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    int rc               = 1;
+
+    if (lauxh_isuserdataof(L, 4, ARENA_MT)) {
+        return luaL_argerror(L, 4,
+                             "arena cannot be used for the parallel decoding");
+    } else if (lua_type(L, 4) == LUA_TTABLE) {
+        lua_getfield(L, 4, "arena");
+        if (!lua_isnil(L, -1)) {
+            return luaL_argerror(
+                L, 4, "arena cannot be used for the parallel decoding");
+        }
+        lua_pop(L, 1);
+        if (getoptfield(L, 4, "mlimit", LUA_TNUMBER) != LUA_TNIL) {
+            maxsize = lua_tointeger(L, -1);
+        }
+        if (getoptfield(L, 4, "threads", LUA_TNUMBER) != LUA_TNIL) {
+            nthread = (long)lua_tointeger(L, -1);
+        }
+        if (getoptfield(L, 4, "min_chunk", LUA_TNUMBER) != LUA_TNIL) {
+            minchunk = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 3);
+    } else {
+        maxsize = lauxh_optinteger(L, 4, 0);
+    }
+    if (flg & YYJSON_READ_ALLOW_COMMENTS) {
+        return luaL_argerror(L, 5, "READ_ALLOW_COMMENTS is not supported");
+    }
+    // the padding bytes of the input string are ignored, and each chunk is
+    // copied and parsed in-situ by the worker thread
+    if (flg & YYJSON_READ_INSITU) {
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+    }
+    flg |= YYJSON_READ_INSITU | YYJSON_READ_STOP_WHEN_DONE;
+
+    // the small input is not worth splitting
+    if (nthread < 1) {
+        nthread = 1;
+    } else if (nthread > PARALLEL_MAX_THREADS) {
+        nthread = PARALLEL_MAX_THREADS;
+    }
+    if (minchunk < 1) {
+        minchunk = 1;
+    }
+    if ((size_t)nthread > len / (size_t)minchunk + 1) {
+        nthread = (long)(len / (size_t)minchunk + 1);
+    }
+
+    lua_settop(L, 4);
+    pushctx_init(L, &ctx, &kc, 4, with_null, with_ref);
+    pushprojection(L, &ctx, 4);
+    chunks = (pchunk_t *)lua_newuserdata(L, sizeof(pchunk_t) * nthread);
+    memset(chunks, 0, sizeof(pchunk_t) * nthread);
+    if (array) {
+        if (!(nchunk = split_array(chunks, nthread, str, len, &err))) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s at %d", err.msg, (int)err.pos);
+            lua_pushinteger(L, err.code);
+            return 3;
+        }
+    } else {
+        nchunk = split_lines(chunks, nthread, str, len);
+    }
+
+    for (size_t i = 0; i < nchunk; i++) {
+        pchunk_t *c = &chunks[i];
+
+        memalloc_setup(&c->m, L, NULL, (maxsize < 0) ? 0 : (size_t)maxsize);
+        c->m.allocf = libc_allocf;
+        c->m.ud     = NULL;
+        c->src      = str;
+        c->flg      = flg;
+        c->array    = array;
+        // the first chunk is parsed by the calling thread
+        if (i > 0) {
+            c->joinable = pthread_create(&c->tid, NULL, pchunk_run, c) == 0;
+        }
+    }
+    for (size_t i = 0; i < nchunk; i++) {
+        pchunk_t *c = &chunks[i];
+        if (c->joinable) {
+            pthread_join(c->tid, NULL);
+        } else {
+            // failed to create the thread
+            pchunk_run(c);
+        }
+        nval += c->ndoc;
+    }
+
+    // report the first error in the input
+    for (size_t i = 0; i < nchunk; i++) {
+        if (chunks[i].err.code != YYJSON_READ_SUCCESS) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s at %d", chunks[i].err.msg,
+                            (int)chunks[i].errpos);
+            lua_pushinteger(L, chunks[i].err.code);
+            rc = 3;
+            goto DONE;
+        }
+    }
+
+    lua_createtable(L, (int)nval, 0);
+    if (array && with_ref) {
+        lauxh_pushref(L, AS_ARRAY_REF);
+        lua_rawseti(L, -2, -1);
+    }
+    nval = 0;
+    for (size_t i = 0; i < nchunk && rc == 1; i++) {
+        pchunk_t *c = &chunks[i];
+        for (size_t j = 0; j < c->ndoc; j++) {
+            yyjson_doc *doc = c->docs[j];
+            // release the doc as soon as it is pushed
+            c->docs[j] = NULL;
+            rc = pushvalue(L, lua_gettop(L), yyjson_doc_get_root(doc), &ctx);
+            yyjson_doc_free(doc);
+            if (rc != 1) {
+                break;
+            }
+            lua_rawseti(L, -2, (int)++nval);
+        }
+    }
+
+DONE:
+    for (size_t i = 0; i < nchunk; i++) {
+        pchunk_free(&chunks[i]);
+    }
+    return rc;
+}
+
+#define ASYNC_MT          "yyjson.async"
+#define ASYNC_MAX_THREADS 4
+
+// decoding job that is shared by the handle and the worker thread of the
+// pool. it is released when both of them have released it.
+typedef struct asyncjob_s {
+    struct asyncjob_s *next;
+    memalloc_t m;
+    char *data;
+    size_t len;
+    yyjson_read_flag flg;
+    yyjson_doc *doc;
+    yyjson_read_err err;
+    // the worker writes a byte to fds[1] when the job is done
+    int fds[2];
+    int refs;
+    int done;
+} asyncjob_t;
+
+typedef struct {
+    asyncjob_t *job;
+    // options to push the result. the key cache is created when the result
+    // is retrieved, and the projection is kept by the reference.
+    pushctx_t ctx;
+    int key_cache;
+    int pref;
+} async_t;
+
+// thread pool that is shared by all the Lua states in the process
+static pthread_mutex_t ASYNC_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ASYNC_COND   = PTHREAD_COND_INITIALIZER;
+static asyncjob_t *ASYNC_HEAD      = NULL;
+static asyncjob_t *ASYNC_TAIL      = NULL;
+static int ASYNC_NTHREAD           = 0;
+static int ASYNC_NIDLE             = 0;
+// the workers are joined when the module is unloaded or the process exits
+static pthread_t ASYNC_THREADS[ASYNC_MAX_THREADS];
+static int ASYNC_SHUTDOWN = 0;
+
+// release the job. ASYNC_MUTEX must be locked.
+static void asyncjob_release(asyncjob_t *job)
+{
+    if (--job->refs == 0) {
+        yyjson_doc_free(job->doc);
+        if (job->data) {
+            job->m.alc.free(job->m.alc.ctx, job->data);
+        }
+        memalloc_dispose(&job->m);
+        close(job->fds[0]);
+        close(job->fds[1]);
+        free(job);
+    }
+}
+
+static void asyncjob_run(asyncjob_t *job)
+{
+    job->doc = yyjson_read_opts(job->data, job->len, job->flg, &job->m.alc,
+                                &job->err);
+}
+
+// notify the handle that the job is done. ASYNC_MUTEX must be locked.
+static void asyncjob_done(asyncjob_t *job)
+{
+    ssize_t rv = 0;
+
+    job->done = 1;
+    do {
+        rv = write(job->fds[1], "", 1);
+    } while (rv == -1 && errno == EINTR);
+    asyncjob_release(job);
+}
+
+static void *async_worker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&ASYNC_MUTEX);
+    for (;;) {
+        asyncjob_t *job = NULL;
+
+        while (!ASYNC_HEAD && !ASYNC_SHUTDOWN) {
+            ASYNC_NIDLE++;
+            pthread_cond_wait(&ASYNC_COND, &ASYNC_MUTEX);
+            ASYNC_NIDLE--;
+        }
+        if (!ASYNC_HEAD) {
+            // the queued jobs are done before the shutdown
+            break;
+        }
+        job        = ASYNC_HEAD;
+        ASYNC_HEAD = job->next;
+        if (!ASYNC_HEAD) {
+            ASYNC_TAIL = NULL;
+        }
+        // the job that the handle has been released is skipped
+        if (job->refs > 1) {
+            pthread_mutex_unlock(&ASYNC_MUTEX);
+            asyncjob_run(job);
+            pthread_mutex_lock(&ASYNC_MUTEX);
+        }
+        asyncjob_done(job);
+    }
+    pthread_mutex_unlock(&ASYNC_MUTEX);
+    return NULL;
+}
+
+// stop the workers before the code of the module is unmapped by dlclose, so
+// that no worker is left running the unmapped code
+__attribute__((destructor)) static void async_shutdown(void)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&ASYNC_MUTEX);
+    ASYNC_SHUTDOWN = 1;
+    n              = ASYNC_NTHREAD;
+    pthread_cond_broadcast(&ASYNC_COND);
+    pthread_mutex_unlock(&ASYNC_MUTEX);
+    for (int i = 0; i < n; i++) {
+        pthread_join(ASYNC_THREADS[i], NULL);
+    }
+}
+
+// add the job to the queue of the pool. the worker thread is created if
+// there is no idle thread.
+static void async_submit(asyncjob_t *job)
+{
+    pthread_mutex_lock(&ASYNC_MUTEX);
+    if (!ASYNC_NIDLE && ASYNC_NTHREAD < ASYNC_MAX_THREADS &&
+        pthread_create(&ASYNC_THREADS[ASYNC_NTHREAD], NULL, async_worker,
+                       NULL) == 0) {
+        ASYNC_NTHREAD++;
+    }
+    if (!ASYNC_NTHREAD || ASYNC_SHUTDOWN) {
+        // failed to create the thread, or the workers are stopped
+        asyncjob_run(job);
+        asyncjob_done(job);
+    } else {
+        if (ASYNC_TAIL) {
+            ASYNC_TAIL->next = job;
+        } else {
+            ASYNC_HEAD = job;
+        }
+        ASYNC_TAIL = job;
+        pthread_cond_signal(&ASYNC_COND);
+    }
+    pthread_mutex_unlock(&ASYNC_MUTEX);
+}
+
+static int async_fd_lua(lua_State *L)
+{
+    async_t *h = (async_t *)luaL_checkudata(L, 1, ASYNC_MT);
+
+    if (!h->job) {
+        lua_pushinteger(L, -1);
+    } else {
+        lua_pushinteger(L, h->job->fds[0]);
+    }
+    return 1;
+}
+
+static int async_done_lua(lua_State *L)
+{
+    async_t *h = (async_t *)luaL_checkudata(L, 1, ASYNC_MT);
+    int done   = 1;
+
+    if (h->job) {
+        pthread_mutex_lock(&ASYNC_MUTEX);
+        done = h->job->done;
+        pthread_mutex_unlock(&ASYNC_MUTEX);
+    }
+    lua_pushboolean(L, done);
+    return 1;
+}
+
+static int async_result_lua(lua_State *L)
+{
+    async_t *h      = (async_t *)luaL_checkudata(L, 1, ASYNC_MT);
+    asyncjob_t *job = h->job;
+    pushctx_t ctx   = h->ctx;
+    yyjson_doc *doc = NULL;
+    keycache_t kc;
+    int done        = 0;
+    int rc          = 0;
+    char c          = 0;
+
+    if (!job) {
+        lua_pushnil(L);
+        lua_pushstring(L, "the result has already been retrieved");
+        lua_pushinteger(L, YYJSON_READ_ERROR_INVALID_PARAMETER);
+        return 3;
+    }
+
+    lua_settop(L, 1);
+    if (h->key_cache) {
+        keycache_init(L, &kc);
+        ctx.keys = &kc;
+    }
+    pthread_mutex_lock(&ASYNC_MUTEX);
+    done = job->done;
+    pthread_mutex_unlock(&ASYNC_MUTEX);
+    if (!done) {
+        // wait for the job to be done
+        ssize_t rv = 0;
+        do {
+            rv = read(job->fds[0], &c, 1);
+        } while (rv == -1 && errno == EINTR);
+    }
+
+    // the worker never touches the doc after the job is done
+    doc      = job->doc;
+    job->doc = NULL;
+    rc       = pushdoc(L, lua_gettop(L), doc, &job->err, &ctx);
+    h->job   = NULL;
+    h->pref  = lauxh_unref(L, h->pref);
+    pthread_mutex_lock(&ASYNC_MUTEX);
+    asyncjob_release(job);
+    pthread_mutex_unlock(&ASYNC_MUTEX);
+
+    return rc;
+}
+
+static int async_gc(lua_State *L)
+{
+    async_t *h = (async_t *)lua_touserdata(L, 1);
+
+    if (h->job) {
+        pthread_mutex_lock(&ASYNC_MUTEX);
+        asyncjob_release(h->job);
+        pthread_mutex_unlock(&ASYNC_MUTEX);
+        h->job = NULL;
+    }
+    h->pref = lauxh_unref(L, h->pref);
+    return 0;
+}
+
+static int async_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, ASYNC_MT ": %p", luaL_checkudata(L, 1, ASYNC_MT));
+    return 1;
+}
+
+static int decode_async_lua(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    lua_Integer maxsize  = 0;
+    asyncjob_t *job      = NULL;
+    async_t *h           = NULL;
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    int pref             = LUA_NOREF;
+
+    if (lauxh_isuserdataof(L, 4, ARENA_MT)) {
+        return luaL_argerror(L, 4,
+                             "arena cannot be used for the async decoding");
+    } else if (lua_type(L, 4) == LUA_TTABLE) {
+        lua_getfield(L, 4, "arena");
+        if (!lua_isnil(L, -1)) {
+            return luaL_argerror(L, 4,
+                                 "arena cannot be used for the async decoding");
+        }
+        lua_pop(L, 1);
+        if (getoptfield(L, 4, "mlimit", LUA_TNUMBER) != LUA_TNIL) {
+            maxsize = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+    } else {
+        maxsize = lauxh_optinteger(L, 4, 0);
+    }
+    lua_settop(L, 4);
+    pushctx_init(L, &ctx, &kc, 4, with_null, with_ref);
+    if (pushprojection(L, &ctx, 4)) {
+        pref = lauxh_ref(L);
+    }
+    // the input is copied and parsed in-situ by the worker thread. the
+    // padding bytes of the input string are ignored.
+    if (flg & YYJSON_READ_INSITU) {
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+    }
+
+    h  = (async_t *)lua_newuserdata(L, sizeof(async_t));
+    *h = (async_t){
+        .ctx       = ctx,
+        .key_cache = ctx.keys != NULL,
+        .pref      = pref,
+    };
+    h->ctx.keys = NULL;
+    luaL_getmetatable(L, ASYNC_MT);
+    lua_setmetatable(L, -2);
+
+    if (!(job = (asyncjob_t *)calloc(1, sizeof(asyncjob_t)))) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    } else if (pipe(job->fds) == -1) {
+        free(job);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    fcntl(job->fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(job->fds[1], F_SETFD, FD_CLOEXEC);
+    // the memory is allocated by the libc allocator in the worker thread
+    memalloc_setup(&job->m, L, NULL, (maxsize < 0) ? 0 : (size_t)maxsize);
+    job->m.allocf = libc_allocf;
+    job->m.ud     = NULL;
+    job->refs     = 1;
+    job->len      = len;
+    job->flg      = flg | YYJSON_READ_INSITU;
+    job->data     = (char *)job->m.alc.malloc(job->m.alc.ctx,
+                                              len + YYJSON_PADDING_SIZE);
+    if (!job->data) {
+        asyncjob_release(job);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    memcpy(job->data, str, len);
+    memset(job->data + len, 0, YYJSON_PADDING_SIZE);
+
+    // the job is referenced by the handle and the pool
+    job->refs = 2;
+    h->job    = job;
+    async_submit(job);
+
+    return 1;
+}
+
+static inline void init_async_mt(lua_State *L)
+{
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       async_gc          },
+        {"__tostring", async_tostring_lua},
+        {NULL,         NULL              }
+    };
+    struct luaL_Reg methods[] = {
+        {"fd",     async_fd_lua    },
+        {"done",   async_done_lua  },
+        {"result", async_result_lua},
+        {NULL,     NULL            }
+    };
+
+    luaL_newmetatable(L, ASYNC_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_newtable(L);
+    for (struct luaL_Reg *ptr = methods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+#define DECODER_MT "yyjson.decoder"
+
+// incremental decoder that accumulates the chunks into the padded buffer.
+// the buffer is parsed in-situ when the document is complete, or each time
+// the chunk completes the lines of a NDJSON.
+typedef struct {
+    memalloc_t m;
+    strbuf_t buf;
+    // number of the bytes that have been scanned for a newline
+    size_t scanned;
+    // number of the bytes that have been consumed from the stream
+    size_t offset;
+    pushctx_t ctx;
+    keycache_t kc;
+    int kref;
+    int pref;
+    yyjson_read_flag flg;
+    int ndjson;
+} decoder_t;
+
+static void decoder_reset(decoder_t *d)
+{
+    d->buf.len = 0;
+    d->scanned = 0;
+    d->offset  = 0;
+}
+
+// parse the values in the first len bytes of the buffer, and append them to
+// the table at the top of the stack. returns 1 on success, otherwise pushes
+// nil, the error message and the error number, and returns 3.
+static int decoder_parse(lua_State *L, decoder_t *d, size_t len)
+{
+    char *data = d->buf.data;
+    size_t pos = skipws(data, 0, len);
+    int tbl    = lua_gettop(L);
+    int n      = (int)lauxh_rawlen(L, tbl);
+    char pad[YYJSON_PADDING_SIZE];
+
+    if (pos >= len) {
+        return 1;
+    }
+    // the bytes after the lines are replaced with the padding while parsing
+    memcpy(pad, data + len, YYJSON_PADDING_SIZE);
+    memset(data + len, 0, YYJSON_PADDING_SIZE);
+    while (pos < len) {
+        yyjson_read_err err = {0};
+        yyjson_doc *doc = yyjson_read_opts(data + pos, len - pos, d->flg,
+                                           &d->m.alc, &err);
+        int rc          = 0;
+
+        if (!doc) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s at %d", err.msg,
+                            (int)(d->offset + pos + err.pos));
+            lua_pushinteger(L, err.code);
+            return 3;
+        }
+        pos += yyjson_doc_get_read_size(doc);
+        rc = pushvalue(L, tbl, yyjson_doc_get_root(doc), &d->ctx);
+        yyjson_doc_free(doc);
+        if (rc > 1) {
+            // failed to push the value
+            lua_pushinteger(L, d->ctx.code);
+            return 3;
+        }
+        lua_rawseti(L, tbl, ++n);
+        pos = skipws(data, pos, len);
+    }
+    memcpy(data + len, pad, YYJSON_PADDING_SIZE);
+    return 1;
+}
+
+// push the key cache table to use it by pushvalue
+static inline void decoder_pushcache(lua_State *L, decoder_t *d)
+{
+    if (d->ctx.keys) {
+        lauxh_pushref(L, d->kref);
+        d->kc.idx = lua_gettop(L);
+    }
+}
+
+static int decoder_feed_lua(lua_State *L)
+{
+    decoder_t *d    = (decoder_t *)luaL_checkudata(L, 1, DECODER_MT);
+    size_t len      = 0;
+    const char *str = lauxh_checklstring(L, 2, &len);
+    size_t eol      = 0;
+
+    lua_settop(L, 2);
+    if (!strbuf_append(&d->buf, str, len)) {
+        decoder_reset(d);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        lua_pushinteger(L, YYJSON_READ_ERROR_MEMORY_ALLOCATION);
+        return 3;
+    } else if (!d->ndjson) {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    // find the last newline in the bytes that have not been scanned
+    for (size_t i = d->buf.len; i > d->scanned; i--) {
+        if (d->buf.data[i - 1] == '\n') {
+            eol = i;
+            break;
+        }
+    }
+    decoder_pushcache(L, d);
+    lua_newtable(L);
+    if (!eol) {
+        d->scanned = d->buf.len;
+    } else if (decoder_parse(L, d, eol) != 1) {
+        // the buffered data is discarded on error
+        decoder_reset(d);
+        return 3;
+    } else {
+        strbuf_consume(&d->buf, eol);
+        d->offset += eol;
+        d->scanned = d->buf.len;
+    }
+    return 1;
+}
+
+static int decoder_finish_lua(lua_State *L)
+{
+    decoder_t *d        = (decoder_t *)luaL_checkudata(L, 1, DECODER_MT);
+    yyjson_read_err err = {0};
+    yyjson_doc *doc     = NULL;
+    char *data          = NULL;
+    int rc              = 0;
+
+    lua_settop(L, 1);
+    if (!(data = strbuf_padded(&d->buf))) {
+        decoder_reset(d);
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        lua_pushinteger(L, YYJSON_READ_ERROR_MEMORY_ALLOCATION);
+        return 3;
+    }
+    decoder_pushcache(L, d);
+
+    if (d->ndjson) {
+        // parse the last line that has no newline
+        lua_newtable(L);
+        rc = decoder_parse(L, d, d->buf.len);
+    } else {
+        doc = yyjson_read_opts(data, d->buf.len, d->flg, &d->m.alc, &err);
+        if (!doc) {
+            err.pos += d->offset;
+        }
+        if ((rc = pushdoc(L, lua_gettop(L), doc, &err, &d->ctx)) == 2) {
+            // failed to push the value
+            lua_pushinteger(L, d->ctx.code);
+            rc = 3;
+        }
+    }
+    // the decoder can be reused for the next stream
+    decoder_reset(d);
+    return rc;
+}
+
+static int decoder_len_lua(lua_State *L)
+{
+    decoder_t *d = (decoder_t *)luaL_checkudata(L, 1, DECODER_MT);
+    lua_pushinteger(L, d->buf.len);
+    return 1;
+}
+
+static int decoder_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, DECODER_MT ": %p", luaL_checkudata(L, 1, DECODER_MT));
+    return 1;
+}
+
+static int decoder_gc(lua_State *L)
+{
+    decoder_t *d = (decoder_t *)lua_touserdata(L, 1);
+
+    strbuf_free(&d->buf);
+    d->kref = lauxh_unref(L, d->kref);
+    d->pref = lauxh_unref(L, d->pref);
+    return 0;
+}
+
+static int decoder_lua(lua_State *L)
+{
+    int with_null        = lauxh_optboolean(L, 1, 0);
+    int with_ref         = lauxh_optboolean(L, 2, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 4);
+    lua_Integer maxsize  = 0;
+    int ndjson           = 0;
+    decoder_t *d         = NULL;
+
+    if (lauxh_isuserdataof(L, 3, ARENA_MT)) {
+        return luaL_argerror(L, 3, "arena cannot be used for the decoder");
+    } else if (lua_type(L, 3) == LUA_TTABLE) {
+        lua_getfield(L, 3, "arena");
+        if (!lua_isnil(L, -1)) {
+            return luaL_argerror(L, 3, "arena cannot be used for the decoder");
+        }
+        lua_pop(L, 1);
+        if (getoptfield(L, 3, "mlimit", LUA_TNUMBER) != LUA_TNIL) {
+            maxsize = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+        ndjson = optfield_boolean(L, 3, "ndjson", 0);
+    } else {
+        maxsize = lauxh_optinteger(L, 3, 0);
+    }
+    lua_settop(L, 3);
+
+    d = (decoder_t *)lua_newuserdata(L, sizeof(decoder_t));
+    memalloc_setup(&d->m, L, NULL, (maxsize < 0) ? 0 : (size_t)maxsize);
+    strbuf_init(&d->buf, &d->m.alc);
+    decoder_reset(d);
+    d->kref   = LUA_NOREF;
+    d->pref   = LUA_NOREF;
+    d->ndjson = ndjson;
+    // the buffer is owned by the decoder, so it is always parsed in-situ
+    d->flg    = flg | YYJSON_READ_INSITU;
+    if (ndjson) {
+        d->flg |= YYJSON_READ_STOP_WHEN_DONE;
+    }
+    luaL_getmetatable(L, DECODER_MT);
+    lua_setmetatable(L, -2);
+    // the key cache table is kept by the reference across the calls
+    pushctx_init(L, &d->ctx, &d->kc, 3, with_null, with_ref);
+    if (d->ctx.keys) {
+        d->kref = lauxh_ref(L);
+    }
+    if (pushprojection(L, &d->ctx, 3)) {
+        d->pref = lauxh_ref(L);
+    }
+    return 1;
+}
+
+static inline void init_decoder_mt(lua_State *L)
+{
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       decoder_gc          },
+        {"__len",      decoder_len_lua     },
+        {"__tostring", decoder_tostring_lua},
+        {NULL,         NULL                }
+    };
+    struct luaL_Reg methods[] = {
+        {"feed",   decoder_feed_lua  },
+        {"finish", decoder_finish_lua},
+        {NULL,     NULL              }
+    };
+
+    luaL_newmetatable(L, DECODER_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_newtable(L);
+    for (struct luaL_Reg *ptr = methods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+static int get_call(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    int with_null        = lauxh_optboolean(L, 3, 0);
+    int with_ref         = lauxh_optboolean(L, 4, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 6);
+    int multi            = lua_type(L, 2) == LUA_TTABLE;
+    yyjson_read_err err  = {0};
+    yyjson_ptr_err perr  = {0};
+    yyjson_doc *doc      = NULL;
+    yyjson_val *val      = NULL;
+    size_t plen          = 0;
+    const char *ptr      = NULL;
+    memalloc_t m         = {0};
+    pushctx_t ctx        = {0};
+    keycache_t kc;
+    statsreg_t *reg      = stats_get(L);
+    double t0            = 0;
+    double t1            = 0;
+    int base             = 0;
+    int rc               = 3;
+
+    if (!multi) {
+        ptr = lauxh_checklstring(L, 2, &plen);
+    } else {
+        // check the pointers before parsing
+        size_t n = lauxh_rawlen(L, 2);
+        for (size_t i = 1; i <= n; i++) {
+            lua_rawgeti(L, 2, i);
+            if (lua_type(L, -1) != LUA_TSTRING) {
+                return luaL_argerror(L, 2, "array of strings expected");
+            }
+            lua_pop(L, 1);
+        }
+    }
+    if (flg & YYJSON_READ_INSITU) {
+        // Lua strings are immutable and may be shared, so they are never
+        // parsed in-situ. the padding bytes are ignored.
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+        flg &= ~YYJSON_READ_INSITU;
+    }
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 5);
+    pushctx_init(L, &ctx, &kc, 5, with_null, with_ref);
+    pushprojection(L, &ctx, 5);
+    memalloc_init(&m, L, 5);
+    base = lua_gettop(L);
+    t0   = stats_clock(reg);
+    doc  = yyjson_read_opts((char *)str, len, flg, &m.alc, &err);
+    t1   = stats_clock(reg);
+    if (!doc) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s at %d", err.msg, err.pos);
+        lua_pushinteger(L, err.code);
+    } else if (!multi) {
+        val = yyjson_doc_ptr_getx(doc, ptr, plen, &perr);
+        if (val) {
+            rc = pushvalue(L, base, val, &ctx);
+        } else {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s at %d", perr.msg, perr.pos);
+            lua_pushinteger(L, perr.code);
+        }
+        yyjson_doc_free(doc);
+    } else {
+        // the values of the unresolved pointers are nil
+        size_t n = lauxh_rawlen(L, 2);
+        rc       = 1;
+        lua_createtable(L, n, 0);
+        for (size_t i = 1; i <= n && rc == 1; i++) {
+            lua_rawgeti(L, 2, i);
+            ptr = lua_tolstring(L, -1, &plen);
+            val = yyjson_doc_ptr_getx(doc, ptr, plen, &perr);
+            lua_pop(L, 1);
+            if (val && (rc = pushvalue(L, base + 1, val, &ctx)) == 1) {
+                lua_rawseti(L, base + 1, i);
+            }
+        }
+        yyjson_doc_free(doc);
+    }
+    stats_record(&reg->decode, &m, t1 - t0, stats_clock(reg) - t1);
+    memalloc_dispose(&m);
+
+    return rc;
+}
+
+static int get_lua(lua_State *L)
+{
+    return arena_call(L, 5, get_call);
+}
+
+#define VIEW_MT "yyjson.view"
+
+// document that is shared by the views.
+// it is released when the last view that refers to it is collected.
+typedef struct {
+    memalloc_t m;
+    yyjson_doc *doc;
+    size_t refs;
+    pushctx_t ctx;
+} viewdoc_t;
+
+typedef struct {
+    viewdoc_t *vd;
+    yyjson_val *val;
+} view_t;
+
+typedef struct {
+    union {
+        yyjson_arr_iter arr;
+        yyjson_obj_iter obj;
+    } it;
+} viewiter_t;
+
+static void viewdoc_release(viewdoc_t *vd)
+{
+    if (vd && --vd->refs == 0) {
+        lua_Alloc allocf = vd->m.allocf;
+        void *ud         = vd->m.ud;
+
+        if (vd->doc) {
+            yyjson_doc_free(vd->doc);
+        }
+        memalloc_dispose(&vd->m);
+        allocf(ud, vd, sizeof(viewdoc_t), 0);
+    }
+}
+
+static view_t *newview(lua_State *L, viewdoc_t *vd, yyjson_val *val)
+{
+    view_t *v = (view_t *)lua_newuserdata(L, sizeof(view_t));
+
+    *v = (view_t){0};
+    luaL_getmetatable(L, VIEW_MT);
+    lua_setmetatable(L, -2);
+    if (vd) {
+        v->vd  = vd;
+        v->val = val;
+        vd->refs++;
+    }
+    return v;
+}
+
+// push a scalar value as a Lua value, or a container value as a view
+static void pushview(lua_State *L, viewdoc_t *vd, yyjson_val *val)
+{
+    if (yyjson_is_ctn(val)) {
+        newview(L, vd, val);
+    } else if (pushvalue(L, lua_gettop(L), val, &vd->ctx) > 1) {
+        // raise the error message
+        lua_error(L);
+    }
+}
+
+static int view_next_lua(lua_State *L)
+{
+    view_t *v      = (view_t *)lua_touserdata(L, lua_upvalueindex(1));
+    viewiter_t *it = (viewiter_t *)lua_touserdata(L, lua_upvalueindex(2));
+    int with_null  = v->vd->ctx.with_null;
+    yyjson_val *val = NULL;
+
+    if (yyjson_is_arr(v->val)) {
+        while ((val = yyjson_arr_iter_next(&it->it.arr))) {
+            if (with_null || !yyjson_is_null(val)) {
+                lua_pushinteger(L, it->it.arr.idx);
+                pushview(L, v->vd, val);
+                return 2;
+            }
+        }
+    } else {
+        yyjson_val *key = NULL;
+        while ((key = yyjson_obj_iter_next(&it->it.obj))) {
+            val = yyjson_obj_iter_get_val(key);
+            if (with_null || !yyjson_is_null(val)) {
+                lua_pushlstring(L, yyjson_get_str(key), yyjson_get_len(key));
+                pushview(L, v->vd, val);
+                return 2;
+            }
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int view_pairs_lua(lua_State *L)
+{
+    view_t *v      = (view_t *)luaL_checkudata(L, 1, VIEW_MT);
+    viewiter_t *it = (viewiter_t *)lua_newuserdata(L, sizeof(viewiter_t));
+
+    if (yyjson_is_arr(v->val)) {
+        yyjson_arr_iter_init(v->val, &it->it.arr);
+    } else {
+        yyjson_obj_iter_init(v->val, &it->it.obj);
+    }
+    lua_pushvalue(L, 1);
+    lua_insert(L, -2);
+    lua_pushcclosure(L, view_next_lua, 2);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+static int view_index_lua(lua_State *L)
+{
+    view_t *v       = (view_t *)luaL_checkudata(L, 1, VIEW_MT);
+    yyjson_val *val = NULL;
+
+    if (yyjson_is_arr(v->val)) {
+        if (lauxh_isinteger(L, 2)) {
+            lua_Integer idx = lua_tointeger(L, 2);
+            if (idx > 0) {
+                val = yyjson_arr_get(v->val, (size_t)idx - 1);
+            }
+        }
+    } else if (lua_type(L, 2) == LUA_TSTRING) {
+        size_t len      = 0;
+        const char *key = lua_tolstring(L, 2, &len);
+        val             = yyjson_obj_getn(v->val, key, len);
+    }
+
+    if (!val) {
+        lua_pushnil(L);
+    } else {
+        pushview(L, v->vd, val);
+    }
+    return 1;
+}
+
+static int view_len_lua(lua_State *L)
+{
+    view_t *v = (view_t *)luaL_checkudata(L, 1, VIEW_MT);
+
+    if (yyjson_is_arr(v->val)) {
+        lua_pushinteger(L, yyjson_arr_size(v->val));
+    } else {
+        lua_pushinteger(L, yyjson_obj_size(v->val));
+    }
+    return 1;
+}
+
+static int view_call_lua(lua_State *L)
+{
+    view_t *v = (view_t *)luaL_checkudata(L, 1, VIEW_MT);
+    return pushvalue(L, 1, v->val, &v->vd->ctx);
+}
+
+static int view_tostring_lua(lua_State *L)
+{
+    view_t *v = (view_t *)luaL_checkudata(L, 1, VIEW_MT);
+    lua_pushfstring(L, VIEW_MT ": %p", v);
+    return 1;
+}
+
+static int view_gc(lua_State *L)
+{
+    view_t *v = (view_t *)lua_touserdata(L, 1);
+    viewdoc_release(v->vd);
+    v->vd = NULL;
+    return 0;
+}
+
+static inline void init_view_mt(lua_State *L)
+{
+    luaL_newmetatable(L, VIEW_MT);
+    lauxh_pushfn2tbl(L, "__gc", view_gc);
+    lauxh_pushfn2tbl(L, "__index", view_index_lua);
+    lauxh_pushfn2tbl(L, "__len", view_len_lua);
+    lauxh_pushfn2tbl(L, "__pairs", view_pairs_lua);
+    lauxh_pushfn2tbl(L, "__call", view_call_lua);
+    lauxh_pushfn2tbl(L, "__tostring", view_tostring_lua);
+    lua_pop(L, 1);
+}
+
+static int table_next_lua(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 2);
+    if (lua_next(L, 1)) {
+        return 2;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static int pairs_lua(lua_State *L)
+{
+    if (lauxh_isuserdataof(L, 1, VIEW_MT)) {
+        return view_pairs_lua(L);
+    }
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_pushcfunction(L, table_next_lua);
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    return 3;
+}
+
+static int parse_lua(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    int with_null        = lauxh_optboolean(L, 2, 0);
+    int with_ref         = lauxh_optboolean(L, 3, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 5);
+    yyjson_read_err err  = {0};
+    memalloc_t m         = {0};
+    pushctx_t ctx        = {0};
+    view_t *v            = NULL;
+    viewdoc_t *vd        = NULL;
+
+    // the document outlives the call, so it cannot be allocated from the
+    // arena that is released when the call returns
+    if (lauxh_isuserdataof(L, 4, ARENA_MT)) {
+        return luaL_argerror(L, 4, "arena cannot be used for the view");
+    } else if (lua_type(L, 4) == LUA_TTABLE) {
+        lua_getfield(L, 4, "arena");
+        if (!lua_isnil(L, -1)) {
+            return luaL_argerror(L, 4, "arena cannot be used for the view");
+        }
+        // the values are created on access, so they cannot be projected
+        lua_getfield(L, 4, "keep");
+        lua_getfield(L, 4, "drop");
+        if (!lua_isnil(L, -1) || !lua_isnil(L, -2)) {
+            return luaL_argerror(L, 4,
+                                 "keep and drop cannot be used for the view");
+        }
+        lua_pop(L, 3);
+    }
+    pushctx_setup(L, &ctx, 4, with_null, with_ref);
+    // the input string is shared with the other values, so it will not be
+    // parsed in-situ. the padding bytes are ignored.
+    if (flg & YYJSON_READ_INSITU) {
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+        flg &= ~YYJSON_READ_INSITU;
+    }
+
+    memalloc_init(&m, L, 4);
+    v  = newview(L, NULL, NULL);
+    vd = (viewdoc_t *)m.allocf(m.ud, NULL, 0, sizeof(viewdoc_t));
+    if (!vd) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        lua_pushinteger(L, YYJSON_READ_ERROR_MEMORY_ALLOCATION);
+        return 3;
+    }
+    *vd = (viewdoc_t){
+        .m    = m,
+        .refs = 1,
+        .ctx  = ctx,
+    };
+    vd->m.alc.ctx = (void *)&vd->m;
+    v->vd         = vd;
+
+    vd->doc = yyjson_read_opts((char *)str, len, flg, &vd->m.alc, &err);
+    if (!vd->doc) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s at %d", err.msg, err.pos);
+        lua_pushinteger(L, err.code);
+        return 3;
+    }
+    v->val = yyjson_doc_get_root(vd->doc);
+
+    if (!yyjson_is_ctn(v->val)) {
+        // scalar value is returned as a Lua value
+        pushview(L, vd, v->val);
+    }
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushinteger(L, yyjson_doc_get_read_size(vd->doc));
+    return 4;
+}
+
+#define TABLEPATH_NSTACK  64
+#define ENCODE_MAX_DEPTH  1000
+#define JSONTYPE_NCACHE   8
+
+typedef enum {
+    JSONTYPE_NONE = -1,
+    JSONTYPE_OBJECT,
+    JSONTYPE_ARRAY,
+} jsontype_t;
+
+// how the keys of the tables are encoded
+typedef enum {
+    // the sequence part and the positive integer keys of the hash part are
+    // encoded as an array, and the keys that are not encoded are ignored
+    TABLE_MODE_DEFAULT,
+    // only the sequence part (1..#table) is encoded as an array
+    TABLE_MODE_RAWLEN,
+    // the table that has the keys that are not encoded is an error
+    TABLE_MODE_STRICT,
+} tablemode_t;
+
+static const char *const TABLE_MODES[] = {
+    "default",
+    "rawlen",
+    "strict",
+    NULL,
+};
+
+// options of the encoding
+typedef struct {
+    size_t max_depth;
+    // encode the empty table as an array
+    int empty_array;
+    tablemode_t mode;
+    // look up the AS_ARRAY and AS_OBJECT markers in the -1st element of the
+    // tables that are not tagged by the metatable
+    int markers;
+} encopt_t;
+
+static const encopt_t ENCOPT_DEFAULT = {
+    ENCODE_MAX_DEPTH,
+    0,
+    TABLE_MODE_DEFAULT,
+    1,
+};
+
+// tables on the path from the root to the value that is being encoded. the
+// table that is already on the path is a circular reference.
+typedef struct {
+    const yyjson_alc *alc;
+    const void **ptrs;
+    const void *stack[TABLEPATH_NSTACK];
+    size_t depth;
+    size_t cap;
+    size_t max_depth;
+    int empty_array;
+    tablemode_t mode;
+    int markers;
+    // copy the strings into the document that outlives the Lua values
+    int copy;
+    // __jsontype field of the metatables that have been looked up
+    struct {
+        const void *mt;
+        jsontype_t type;
+    } mtcache[JSONTYPE_NCACHE];
+    // error of the push operation
+    const char *errmsg;
+    yyjson_write_code code;
+} tablepath_t;
+
+static void tablepath_init(tablepath_t *p, const yyjson_alc *alc,
+                           const encopt_t *opt)
+{
+    p->alc         = alc;
+    p->ptrs        = p->stack;
+    p->depth       = 0;
+    p->cap         = TABLEPATH_NSTACK;
+    p->max_depth   = opt->max_depth;
+    p->empty_array = opt->empty_array;
+    p->mode        = opt->mode;
+    p->markers     = opt->markers;
+    p->copy        = 0;
+    p->errmsg      = NULL;
+    p->code        = YYJSON_WRITE_SUCCESS;
+    memset(p->mtcache, 0, sizeof(p->mtcache));
+}
+
+static void tablepath_free(tablepath_t *p)
+{
+    if (p->ptrs != p->stack) {
+        p->alc->free(p->alc->ctx, p->ptrs);
+        p->ptrs = p->stack;
+    }
+}
+
+static int tablepath_error(tablepath_t *p, const char *errmsg,
+                           yyjson_write_code code)
+{
+    p->errmsg = errmsg;
+    p->code   = code;
+    return 0;
+}
+
+// push the table at idx to the path. returns 0 if the table is a circular
+// reference, the path exceeds the maximum depth, or it failed to alloc memory.
+static int tablepath_push(tablepath_t *p, lua_State *L, int idx)
+{
+    const void *ptr = lua_topointer(L, idx);
+
+    if (p->max_depth && p->depth >= p->max_depth) {
+        return tablepath_error(p, "exceeded the maximum depth",
+                               YYJSON_WRITE_ERROR_INVALID_VALUE_TYPE);
+    } else if (!lua_checkstack(L, 3)) {
+        // the Lua stack is exhausted same as the memory
+        return tablepath_error(p, "out of stack space",
+                               YYJSON_WRITE_ERROR_MEMORY_ALLOCATION);
+    }
+    for (size_t i = 0; i < p->depth; i++) {
+        if (p->ptrs[i] == ptr) {
+            return tablepath_error(p, "circular reference detected",
+                                   YYJSON_WRITE_ERROR_INVALID_VALUE_TYPE);
+        }
+    }
+
+    if (p->depth == p->cap) {
+        size_t size   = sizeof(const void *) * p->cap;
+        void *newptrs = NULL;
+
+        if (p->ptrs == p->stack) {
+            if ((newptrs = p->alc->malloc(p->alc->ctx, size * 2))) {
+                memcpy(newptrs, p->stack, size);
+            }
+        } else {
+            newptrs = p->alc->realloc(p->alc->ctx, p->ptrs, size, size * 2);
+        }
+        if (!newptrs) {
+            return tablepath_error(p, strerror(ENOMEM),
+                                   YYJSON_WRITE_ERROR_MEMORY_ALLOCATION);
+        }
+        p->ptrs = (const void **)newptrs;
+        p->cap *= 2;
+    }
+    p->ptrs[p->depth++] = ptr;
+    return 1;
+}
+
+static inline void tablepath_pop(tablepath_t *p)
+{
+    p->depth--;
+}
+
+// get the encoding options of the options table at idx
+static void optencopt(lua_State *L, int idx, encopt_t *opt)
+{
+    static const char *const EMPTY_TABLES[] = {
+        "object",
+        "array",
+        NULL,
+    };
+
+    *opt = ENCOPT_DEFAULT;
+    if (lua_type(L, idx) == LUA_TTABLE) {
+        if (getoptfield(L, idx, "max_depth", LUA_TNUMBER) != LUA_TNIL) {
+            lua_Integer depth = lua_tointeger(L, -1);
+            opt->max_depth    = (depth < 0) ? 0 : (size_t)depth;
+        }
+        lua_pop(L, 1);
+        opt->empty_array = optfield_name(L, idx, "empty_table", EMPTY_TABLES,
+                                         0, "'object' or 'array'");
+        opt->mode        = (tablemode_t)optfield_name(
+            L, idx, "table_mode", TABLE_MODES, TABLE_MODE_DEFAULT,
+            "'default', 'rawlen' or 'strict'");
+        opt->markers     = optfield_boolean(L, idx, "markers", 1);
+    }
+}
+
+// get the encoding options of the optional options table at idx, and the
+// flags that follow it
+static yyjson_write_flag optencargs(lua_State *L, int idx, encopt_t *opt)
+{
+    optencopt(L, idx, opt);
+    if (lua_type(L, idx) == LUA_TTABLE) {
+        idx++;
+    }
+    return lauxh_optflags(L, idx);
+}
+
+static yyjson_mut_val *tovalue(yyjson_mut_doc *doc, lua_State *L, int idx,
+                               tablepath_t *path);
+
+// returns 1 if the value at idx can be encoded
+static inline int isencodable(lua_State *L, int idx)
+{
+    switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+    case LUA_TBOOLEAN:
+    case LUA_TNUMBER:
+    case LUA_TSTRING:
+    case LUA_TTABLE:
+        return 1;
+    case LUA_TUSERDATA:
+        return lua_touserdata(L, idx) == AS_NULL || toraw(L, idx);
+    default:
+        return 0;
+    }
+}
+
+// returns 1 if the key/value pair at the top of the stack is the -1st
+// element marker of the table
+static inline int ismarker(lua_State *L)
+{
+    if (lauxh_isinteger(L, -2) && lua_tointeger(L, -2) == -1) {
+        const void *ptr = lua_touserdata(L, -1);
+        return ptr && (ptr == AS_ARRAY || ptr == AS_OBJECT);
+    }
+    return 0;
+}
+
+// in the strict mode, check that every key and value of the table at idx is
+// encoded as an element of the array or a member of the object.
+static int tablepath_strict(tablepath_t *p, lua_State *L, int idx, int array)
+{
+    if (p->mode != TABLE_MODE_STRICT) {
+        return 1;
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        const char *errmsg = NULL;
+
+        if (ismarker(L)) {
+            // the marker is not encoded
+        } else if (array && (!lauxh_isinteger(L, -2) ||
+                             lua_tointeger(L, -2) < 1)) {
+            errmsg = "array has a key that is not a positive integer";
+        } else if (!array && lua_type(L, -2) != LUA_TSTRING) {
+            errmsg = "object has a non-string key";
+        } else if (!isencodable(L, -1)) {
+            errmsg = "unsupported value type";
+        }
+        lua_pop(L, 1);
+        if (errmsg) {
+            lua_pop(L, 1);
+            return tablepath_error(p, errmsg,
+                                   YYJSON_WRITE_ERROR_INVALID_VALUE_TYPE);
+        }
+    }
+    return 1;
+}
+
+static inline yyjson_mut_val *tonumval(yyjson_mut_doc *doc, lua_State *L,
+                                       int idx)
+{
+    if (lauxh_isinteger(L, idx)) {
+        lua_Integer ival = lua_tointeger(L, idx);
+        if (ival > 0) {
+            return yyjson_mut_uint(doc, ival);
+        }
+        return yyjson_mut_sint(doc, ival);
+    }
+    return yyjson_mut_real(doc, lua_tonumber(L, idx));
+}
+
+static int cmp_integer(const void *a, const void *b)
+{
+    lua_Integer x = *(const lua_Integer *)a;
+    lua_Integer y = *(const lua_Integer *)b;
+    return (x > y) - (x < y);
+}
+
+// append the value at the top of the stack as the i-th element of the array.
+// the elements between the last index *prev and i are filled with null.
+// the value that cannot be converted is skipped.
+static int arr_append(yyjson_mut_doc *doc, lua_State *L, yyjson_mut_val *arr,
+                      lua_Integer *prev, lua_Integer i, tablepath_t *path)
+{
+    yyjson_mut_val *val = tovalue(doc, L, lua_gettop(L), path);
+
+    if (path->errmsg) {
+        return 0;
+    } else if (val) {
+        for (lua_Integer n = *prev + 1; n < i; n++) {
+            yyjson_mut_val *nullval = yyjson_mut_null(doc);
+            if (!nullval || !yyjson_mut_arr_append(arr, nullval)) {
+                // failed to alloc memory
+                return 0;
+            }
+        }
+        *prev = i;
+        return yyjson_mut_arr_append(arr, val);
+    }
+    return 1;
+}
+
+// the positive integer keys that are not visited in ascending order during
+// the traversal of a table, that are appended after sorting.
+typedef struct {
+    lua_Integer *keys;
+    size_t len;
+    size_t cap;
+} intkeys_t;
+
+// append the key to the list. returns 0 if failed to alloc memory, and the
+// list is released.
+static int intkeys_append(intkeys_t *list, const yyjson_alc *alc,
+                          lua_Integer key)
+{
+    if (list->len == list->cap) {
+        size_t cap = (list->cap) ? list->cap * 2 : 16;
+        void *keys = NULL;
+
+        if (!list->keys) {
+            keys = alc->malloc(alc->ctx, sizeof(lua_Integer) * cap);
+        } else {
+            keys = alc->realloc(alc->ctx, list->keys,
+                                sizeof(lua_Integer) * list->cap,
+                                sizeof(lua_Integer) * cap);
+        }
+        if (!keys) {
+            // failed to alloc memory
+            if (list->keys) {
+                alc->free(alc->ctx, list->keys);
+                list->keys = NULL;
+            }
+            return 0;
+        }
+        list->keys = (lua_Integer *)keys;
+        list->cap  = cap;
+    }
+    list->keys[list->len++] = key;
+    return 1;
+}
+
+static void intkeys_free(intkeys_t *list, const yyjson_alc *alc)
+{
+    if (list->keys) {
+        alc->free(alc->ctx, list->keys);
+        list->keys = NULL;
+    }
+}
+
+// returns the positive integer key at the index -2 while the table is
+// traversed by lua_next, or 0 for the other keys.
+static inline lua_Integer toposkey(lua_State *L)
+{
+    if (lauxh_isinteger(L, -2)) {
+        lua_Integer key = lua_tointeger(L, -2);
+        return (key > 0) ? key : 0;
+    }
+    return 0;
+}
+
+// convert the table at idx to an array.
+// the table is traversed once, and the elements are appended in the
+// traversal order while the keys are consecutive from 1, that is the order
+// of the array part of the table. the other positive integer keys are sorted
+// before appending, so the elements are never inserted into the middle of
+// the array.
+static yyjson_mut_val *toarray(yyjson_mut_doc *doc, lua_State *L, int idx,
+                               tablepath_t *path)
+{
+    yyjson_mut_val *arr = yyjson_mut_arr(doc);
+    lua_Integer prev    = 0;
+    lua_Integer next    = 1;
+    intkeys_t rest      = {0};
+
+    if (!arr) {
+        // failed to alloc memory
+        return NULL;
+    }
+
+    if (path->mode == TABLE_MODE_RAWLEN) {
+        // the hash part is not scanned
+        size_t len = lauxh_rawlen(L, idx);
+        for (size_t i = 1; i <= len; i++) {
+            lua_rawgeti(L, idx, i);
+            if (!lua_isnil(L, -1) &&
+                !arr_append(doc, L, arr, &prev, (lua_Integer)i, path)) {
+                lua_pop(L, 1);
+                return NULL;
+            }
+            lua_pop(L, 1);
+        }
+        return arr;
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        lua_Integer key = toposkey(L);
+        if (key == next) {
+            next++;
+            if (!arr_append(doc, L, arr, &prev, key, path)) {
+                lua_pop(L, 2);
+                intkeys_free(&rest, &doc->alc);
+                return NULL;
+            }
+        } else if (key && !intkeys_append(&rest, &doc->alc, key)) {
+            // failed to alloc memory
+            lua_pop(L, 2);
+            return NULL;
+        }
+        lua_pop(L, 1);
+    }
+
+    if (rest.len) {
+        qsort(rest.keys, rest.len, sizeof(lua_Integer), cmp_integer);
+    }
+    for (size_t i = 0; i < rest.len; i++) {
+        lua_rawgeti(L, idx, rest.keys[i]);
+        if (!arr_append(doc, L, arr, &prev, rest.keys[i], path)) {
+            lua_pop(L, 1);
+            intkeys_free(&rest, &doc->alc);
+            return NULL;
+        }
+        lua_pop(L, 1);
+    }
+    intkeys_free(&rest, &doc->alc);
+    return arr;
+}
+
+// get the __jsontype field of the metatable at the top of the stack, and pop
+// the metatable. the field is looked up once per metatable in the call.
+static jsontype_t tojsontype(lua_State *L, tablepath_t *path)
+{
+    const void *mt  = lua_topointer(L, -1);
+    jsontype_t type = JSONTYPE_NONE;
+    size_t slot     = ((uintptr_t)mt >> 4) & (JSONTYPE_NCACHE - 1);
+
+    if (mt == ARRAY_MTPTR) {
+        type = JSONTYPE_ARRAY;
+    } else if (mt == OBJECT_MTPTR) {
+        type = JSONTYPE_OBJECT;
+    } else if (path->mtcache[slot].mt == mt) {
+        type = path->mtcache[slot].type;
+    } else {
+        lua_pushliteral(L, "__jsontype");
+        lua_rawget(L, -2);
+        if (lua_type(L, -1) == LUA_TSTRING) {
+            const char *name = lua_tostring(L, -1);
+            if (strcmp(name, "array") == 0) {
+                type = JSONTYPE_ARRAY;
+            } else if (strcmp(name, "object") == 0) {
+                type = JSONTYPE_OBJECT;
+            }
+        }
+        lua_pop(L, 1);
+        path->mtcache[slot].mt   = mt;
+        path->mtcache[slot].type = type;
+    }
+    lua_pop(L, 1);
+    return type;
+}
+
+// returns 1 if the table at idx should be treated as an array.
+// if the __jsontype field of the metatable is "array" or "object", or the
+// -1st element of a table is AS_ARRAY or AS_OBJECT, the table is treated as
+// that data type. the -1st element is not looked up if the markers option is
+// false. the empty table is treated as an array if the empty_table option is
+// "array".
+static inline int isarray(lua_State *L, int idx, tablepath_t *path)
+{
+    if (lua_getmetatable(L, idx)) {
+        jsontype_t type = tojsontype(L, path);
+        if (type != JSONTYPE_NONE) {
+            return type == JSONTYPE_ARRAY;
+        }
+    }
+
+    if (path->markers) {
+        lua_rawgeti(L, idx, -1);
+        if (lua_type(L, -1) == LUA_TUSERDATA) {
+            const void *ptr = lua_topointer(L, -1);
+            lua_pop(L, 1);
+            if (ptr == AS_OBJECT) {
+                return 0;
+            } else if (ptr == AS_ARRAY) {
+                return 1;
+            }
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    if (lauxh_rawlen(L, idx) > 0) {
+        return 1;
+    } else if (path->empty_array) {
+        // the table that has no elements is treated as an array
+        lua_pushnil(L);
+        if (lua_next(L, idx) != 0) {
+            lua_pop(L, 2);
+            return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static yyjson_mut_val *tovalue(yyjson_mut_doc *doc, lua_State *L, int idx,
+                               tablepath_t *path)
+{
+    switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+        return yyjson_mut_null(doc);
+
+    case LUA_TBOOLEAN:
+        return yyjson_mut_bool(doc, lua_toboolean(L, idx));
+
+    case LUA_TNUMBER:
+        return tonumval(doc, L, idx);
+
+    case LUA_TSTRING: {
+        size_t len      = 0;
+        const char *str = lua_tolstring(L, idx, &len);
+        if (path->copy) {
+            return yyjson_mut_strncpy(doc, str, len);
+        }
+        return yyjson_mut_strn(doc, str, len);
+    }
+
+    case LUA_TTABLE: {
+        yyjson_mut_val *bin = NULL;
+        int array           = 0;
+
+        if (!tablepath_push(path, L, idx)) {
+            return NULL;
+        }
+        array = isarray(L, idx, path);
+        if (!tablepath_strict(path, L, idx, array)) {
+            return NULL;
+        }
+
+        // as array
+        if (array) {
+            bin = toarray(doc, L, idx, path);
+            tablepath_pop(path);
+            return bin;
+        }
+
+        // as object
+        if (!(bin = yyjson_mut_obj(doc))) {
+            // failed to alloc memory
+            return NULL;
+        }
+        lua_pushnil(L);
+        while (lua_next(L, idx) != 0) {
+            yyjson_mut_val *val = NULL;
+
+            if (lua_type(L, -2) == LUA_TSTRING &&
+                (val = tovalue(doc, L, lua_gettop(L), path))) {
+                yyjson_mut_val *key = tovalue(doc, L, lua_gettop(L) - 1, path);
+                if (!key) {
+                    // failed to alloc memory
+                    return NULL;
+                }
+                yyjson_mut_obj_add(bin, key, val);
+            } else if (path->errmsg) {
+                return NULL;
+            }
+            lua_pop(L, 1);
+        }
+        tablepath_pop(path);
+        return bin;
+    }
+
+    case LUA_TUSERDATA: {
+        raw_t *r = NULL;
+
+        if (lua_touserdata(L, idx) == AS_NULL) {
+            return yyjson_mut_null(doc);
+        } else if ((r = toraw(L, idx))) {
+            if (path->copy) {
+                return yyjson_mut_rawncpy(doc, r->str, r->len);
+            }
+            // the fragment is referenced until the document is written
+            return yyjson_mut_rawn(doc, r->str, r->len);
+        }
+        return NULL;
+    }
+
+    // case LUA_TLIGHTUSERDATA:
+    // case LUA_TFUNCTION:
+    // case LUA_TTHREAD:
+    default:
+        return NULL;
+    }
+}
+
+// create a document from the Lua value at idx
+static yyjson_mut_doc *todoc(lua_State *L, int idx, memalloc_t *m,
+                             const encopt_t *opt, yyjson_write_err *err)
+{
+    yyjson_mut_doc *doc = yyjson_mut_doc_new(&m->alc);
+    yyjson_mut_val *val = NULL;
+    tablepath_t path;
+
+    if (!doc) {
+        err->msg  = strerror(ENOMEM);
+        err->code = YYJSON_WRITE_ERROR_MEMORY_ALLOCATION;
+        return NULL;
+    }
+
+    tablepath_init(&path, &m->alc, opt);
+    val = tovalue(doc, L, idx, &path);
+    tablepath_free(&path);
+    if (path.errmsg && !m->nomem) {
+        yyjson_mut_doc_free(doc);
+        err->msg  = path.errmsg;
+        err->code = path.code;
+        return NULL;
+    } else if (m->nomem || (!val && !(val = yyjson_mut_null(doc)))) {
+        yyjson_mut_doc_free(doc);
+        err->msg  = strerror(ENOMEM);
+        err->code = YYJSON_WRITE_ERROR_MEMORY_ALLOCATION;
+        return NULL;
+    }
+    yyjson_mut_doc_set_root(doc, val);
+
+    return doc;
+}
+
+typedef struct writer_s writer_t;
+
+// writer that writes the Lua value directly into the buffer without building
+// a yyjson_mut_doc.
+struct writer_s {
+    strbuf_t *buf;
+    yyjson_write_flag flg;
+    yyjson_write_err err;
+    // allocator for the temporary memory
+    const yyjson_alc *alc;
+    // pool allocator for the number writer of yyjson
+    yyjson_alc pool;
+    uint64_t poolbuf[64];
+    int indent;
+    tablepath_t path;
+    // if set, it is called before writing a value when the buffer has
+    // WRITER_FLUSH_SIZE bytes or more, and returns 0 to abort the writing.
+    int (*flush)(writer_t *w);
+    void *ctx;
+};
+
+#define WRITER_FLUSH_SIZE 65536
+
+static void writer_init(writer_t *w, strbuf_t *buf, yyjson_write_flag flg,
+                        const yyjson_alc *alc, const encopt_t *opt)
+{
+    tablepath_init(&w->path, alc, opt);
+    w->buf    = buf;
+    w->flg    = flg;
+    w->err    = (yyjson_write_err){0};
+    w->alc    = alc;
+    w->flush  = NULL;
+    w->ctx    = NULL;
+    w->indent = (flg & YYJSON_WRITE_PRETTY_TWO_SPACES) ? 2 :
+                (flg & YYJSON_WRITE_PRETTY)            ? 4 :
+                                                         0;
+    yyjson_alc_pool_init(&w->pool, w->poolbuf, sizeof(w->poolbuf));
+}
+
+static int writer_nomem(writer_t *w)
+{
+    w->err.msg  = strerror(ENOMEM);
+    w->err.code = YYJSON_WRITE_ERROR_MEMORY_ALLOCATION;
+    return 0;
+}
+
+static int writer_patherror(writer_t *w)
+{
+    w->err.msg  = w->path.errmsg;
+    w->err.code = w->path.code;
+    return 0;
+}
+
+static inline int writer_raw(writer_t *w, const char *str, size_t len)
+{
+    return strbuf_append(w->buf, str, len) || writer_nomem(w);
+}
+
+static inline int writer_char(writer_t *w, char c)
+{
+    if (w->buf->len < w->buf->cap || strbuf_reserve(w->buf, 1)) {
+        w->buf->data[w->buf->len++] = c;
+        return 1;
+    }
+    return writer_nomem(w);
+}
+
+// write a newline and the indentation of the depth if the pretty flag is set
+static int writer_newline(writer_t *w, int depth)
+{
+    if (w->indent) {
+        size_t n = (size_t)w->indent * (size_t)depth + 1;
+        if (!strbuf_reserve(w->buf, n)) {
+            return writer_nomem(w);
+        }
+        w->buf->data[w->buf->len] = '\n';
+        memset(w->buf->data + w->buf->len + 1, ' ', n - 1);
+        w->buf->len += n;
+    }
+    return 1;
+}
+
+// write the value with the writer of yyjson
+static int writer_yyjson(writer_t *w, yyjson_mut_val *val,
+                         const yyjson_alc *alc)
+{
+    size_t len = 0;
+    char *str  = yyjson_mut_val_write_opts(val, w->flg, alc, &len, &w->err);
+    int rc     = 0;
+
+    if (str) {
+        rc = writer_raw(w, str, len);
+        alc->free(alc->ctx, str);
+    }
+    return rc;
+}
+
+static int writer_number(writer_t *w, lua_State *L, int idx)
+{
+    yyjson_mut_val val = {0};
+
+    if (lauxh_isinteger(L, idx)) {
+        lua_Integer ival = lua_tointeger(L, idx);
+        uint64_t uval    = (ival < 0) ? 0 - (uint64_t)ival : (uint64_t)ival;
+        char str[24];
+        char *ptr = str + sizeof(str);
+
+        do {
+            *--ptr = '0' + (char)(uval % 10);
+            uval /= 10;
+        } while (uval);
+        if (ival < 0) {
+            *--ptr = '-';
+        }
+        return writer_raw(w, ptr, (size_t)(str + sizeof(str) - ptr));
+    }
+    yyjson_mut_set_real(&val, lua_tonumber(L, idx));
+    return writer_yyjson(w, &val, &w->pool);
+}
+
+static int writer_string(writer_t *w, const char *str, size_t len)
+{
+    const unsigned char *ptr = (const unsigned char *)str;
+    const unsigned char *end = ptr + len;
+    int slash                = w->flg & YYJSON_WRITE_ESCAPE_SLASHES;
+
+    // the control and non-ASCII characters are rare, so such strings are
+    // written by yyjson to validate and escape them in the same way
+    for (const unsigned char *c = ptr; c < end; c++) {
+        if (*c < 0x20 || *c >= 0x80) {
+            yyjson_mut_val val = {0};
+            yyjson_mut_set_strn(&val, str, len);
+            return writer_yyjson(w, &val, w->alc);
+        }
+    }
+
+    // the worst case is that every character is escaped
+    if (len > (SIZE_MAX - 2) / 2 || !strbuf_reserve(w->buf, len * 2 + 2)) {
+        return writer_nomem(w);
+    }
+    w->buf->data[w->buf->len++] = '"';
+    while (ptr < end) {
+        const unsigned char *head = ptr;
+        while (ptr < end && *ptr != '"' && *ptr != '\\' &&
+               (*ptr != '/' || !slash)) {
+            ptr++;
+        }
+        memcpy(w->buf->data + w->buf->len, head, (size_t)(ptr - head));
+        w->buf->len += (size_t)(ptr - head);
+        if (ptr < end) {
+            w->buf->data[w->buf->len++] = '\\';
+            w->buf->data[w->buf->len++] = (char)*ptr++;
+        }
+    }
+    w->buf->data[w->buf->len++] = '"';
+    return 1;
+}
+
+static int writer_value(writer_t *w, lua_State *L, int idx, int depth);
+
+// write the i-th element at the top of the stack. the elements between the
+// last index *prev and i are written as null.
+static int writer_element(writer_t *w, lua_State *L, int depth,
+                          lua_Integer *prev, lua_Integer i)
+{
+    if (isencodable(L, -1)) {
+        for (lua_Integer n = *prev + 1; n <= i; n++) {
+            if ((n > 1 && !writer_char(w, ',')) ||
+                !writer_newline(w, depth + 1) ||
+                (n < i && !writer_raw(w, "null", 4))) {
+                return 0;
+            }
+        }
+        *prev = i;
+        return writer_value(w, L, lua_gettop(L), depth + 1);
+    }
+    return 1;
+}
+
+// write the table at idx as an array in the same order as toarray.
+static int writer_array(writer_t *w, lua_State *L, int idx, int depth)
+{
+    lua_Integer prev = 0;
+    lua_Integer next = 1;
+    intkeys_t rest   = {0};
+
+    if (!writer_char(w, '[')) {
+        return 0;
+    }
+
+    if (w->path.mode == TABLE_MODE_RAWLEN) {
+        // the hash part is not scanned
+        size_t len = lauxh_rawlen(L, idx);
+        for (size_t i = 1; i <= len; i++) {
+            lua_rawgeti(L, idx, i);
+            if (!lua_isnil(L, -1) &&
+                !writer_element(w, L, depth, &prev, (lua_Integer)i)) {
+                lua_pop(L, 1);
+                return 0;
+            }
+            lua_pop(L, 1);
+        }
+        return (!prev || writer_newline(w, depth)) && writer_char(w, ']');
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        lua_Integer key = toposkey(L);
+        if (key == next) {
+            next++;
+            if (!writer_element(w, L, depth, &prev, key)) {
+                lua_pop(L, 2);
+                intkeys_free(&rest, w->alc);
+                return 0;
+            }
+        } else if (key && !intkeys_append(&rest, w->alc, key)) {
+            lua_pop(L, 2);
+            return writer_nomem(w);
+        }
+        lua_pop(L, 1);
+    }
+
+    if (rest.len) {
+        qsort(rest.keys, rest.len, sizeof(lua_Integer), cmp_integer);
+    }
+    for (size_t i = 0; i < rest.len; i++) {
+        lua_rawgeti(L, idx, rest.keys[i]);
+        if (!writer_element(w, L, depth, &prev, rest.keys[i])) {
+            lua_pop(L, 1);
+            intkeys_free(&rest, w->alc);
+            return 0;
+        }
+        lua_pop(L, 1);
+    }
+    intkeys_free(&rest, w->alc);
+
+    return (!prev || writer_newline(w, depth)) && writer_char(w, ']');
+}
+
+static int writer_object(writer_t *w, lua_State *L, int idx, int depth)
+{
+    int n = 0;
+
+    if (!writer_char(w, '{')) {
+        return 0;
+    }
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        if (lua_type(L, -2) == LUA_TSTRING && isencodable(L, -1)) {
+            size_t len      = 0;
+            const char *key = lua_tolstring(L, -2, &len);
+            if ((n++ && !writer_char(w, ',')) ||
+                !writer_newline(w, depth + 1) ||
+                !writer_string(w, key, len) ||
+                !writer_raw(w, ": ", (w->indent) ? 2 : 1) ||
+                !writer_value(w, L, lua_gettop(L), depth + 1)) {
+                lua_pop(L, 2);
+                return 0;
+            }
+        }
+        lua_pop(L, 1);
+    }
+
+    return (!n || writer_newline(w, depth)) && writer_char(w, '}');
+}
+
+static int writer_value(writer_t *w, lua_State *L, int idx, int depth)
+{
+    if (w->flush && w->buf->len >= WRITER_FLUSH_SIZE && !w->flush(w)) {
+        return 0;
+    }
+
+    switch (lua_type(L, idx)) {
+    case LUA_TBOOLEAN:
+        if (lua_toboolean(L, idx)) {
+            return writer_raw(w, "true", 4);
+        }
+        return writer_raw(w, "false", 5);
+
+    case LUA_TNUMBER:
+        return writer_number(w, L, idx);
+
+    case LUA_TSTRING: {
+        size_t len      = 0;
+        const char *str = lua_tolstring(L, idx, &len);
+        return writer_string(w, str, len);
+    }
+
+    case LUA_TTABLE: {
+        int array = 0;
+        int rc    = 0;
+
+        if (!tablepath_push(&w->path, L, idx)) {
+            return writer_patherror(w);
+        }
+        array = isarray(L, idx, &w->path);
+        if (!tablepath_strict(&w->path, L, idx, array)) {
+            return writer_patherror(w);
+        } else if (array) {
+            rc = writer_array(w, L, idx, depth);
+        } else {
+            rc = writer_object(w, L, idx, depth);
+        }
+        tablepath_pop(&w->path);
+        return rc;
+    }
+
+    case LUA_TUSERDATA: {
+        raw_t *r = toraw(L, idx);
+        if (r) {
+            return writer_raw(w, r->str, r->len);
+        }
+        return writer_raw(w, "null", 4);
+    }
+
+    // case LUA_TNIL:
+    default:
+        return writer_raw(w, "null", 4);
+    }
+}
+
+// encode the value at idx directly into the buffer. on failure, it pushes nil,
+// the error message and the error number, and returns 3.
+static int writer_encode(lua_State *L, int idx, strbuf_t *buf,
+                         yyjson_write_flag flg, memalloc_t *m,
+                         const encopt_t *opt)
+{
+    writer_t w;
+    int ok = 0;
+
+    writer_init(&w, buf, flg, &m->alc, opt);
+    ok = writer_value(&w, L, idx, 0);
+    tablepath_free(&w.path);
+    if (!ok || m->nomem) {
+        if (m->nomem) {
+            writer_nomem(&w);
+        }
+        lua_pushnil(L);
+        lua_pushstring(L, w.err.msg);
+        lua_pushinteger(L, w.err.code);
+        return 3;
+    }
+    return 0;
+}
+
+static int encode_direct(lua_State *L, int idx, yyjson_write_flag flg,
+                         memalloc_t *m, const encopt_t *opt)
+{
+    strbuf_t buf = {0};
+    int rc       = 0;
+
+    strbuf_init(&buf, &m->alc);
+    if (!(rc = writer_encode(L, idx, &buf, flg, m, opt))) {
+        lua_pushlstring(L, buf.data, buf.len);
+        rc = 1;
+    }
+    strbuf_free(&buf);
+    return rc;
+}
+
+// append the JSON string of the value to the buffer. the content of the
+// buffer is not changed on failure.
+static int buffer_encode_lua(lua_State *L)
+{
+    buffer_t *b           = (buffer_t *)luaL_checkudata(L, 1, BUFFER_MT);
+    encopt_t opt          = ENCOPT_DEFAULT;
+    yyjson_write_flag flg = optencargs(L, 3, &opt);
+    size_t len            = b->buf.len;
+    int rc                = 0;
+
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    b->m.nomem = 0;
+    if ((rc = writer_encode(L, 2, &b->buf, flg, &b->m, &opt))) {
+        b->buf.len = len;
+        return rc;
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+#define WRITER_MT "yyjson.writer"
+
+// the writer keeps the output buffer across the calls, so the capacity grows
+// to the high-water mark and stays there until reset.
+static int writer_encode_lua(lua_State *L)
+{
+    buffer_t *b           = (buffer_t *)luaL_checkudata(L, 1, WRITER_MT);
+    encopt_t opt          = ENCOPT_DEFAULT;
+    yyjson_write_flag flg = optencargs(L, 3, &opt);
+    int rc                = 0;
+
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    b->buf.len = 0;
+    b->m.nomem = 0;
+    if (!(rc = writer_encode(L, 2, &b->buf, flg, &b->m, &opt))) {
+        lua_pushlstring(L, b->buf.data, b->buf.len);
+        rc = 1;
+    }
+    b->buf.len = 0;
+    return rc;
+}
+
+static int writer_reset_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, WRITER_MT);
+    strbuf_free(&b->buf);
+    return 0;
+}
+
+static int writer_len_lua(lua_State *L)
+{
+    buffer_t *b = (buffer_t *)luaL_checkudata(L, 1, WRITER_MT);
+    lua_pushinteger(L, b->buf.cap);
+    return 1;
+}
+
+static int writer_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, WRITER_MT ": %p", luaL_checkudata(L, 1, WRITER_MT));
+    return 1;
+}
+
+static int writer_lua(lua_State *L)
+{
+    lua_Integer size    = lauxh_optinteger(L, 1, 0);
+    lua_Integer maxsize = lauxh_optinteger(L, 2, 0);
+    buffer_t *b         = (buffer_t *)lua_newuserdata(L, sizeof(buffer_t));
+
+    memalloc_setup(&b->m, L, NULL, (maxsize < 0) ? 0 : (size_t)maxsize);
+    strbuf_init(&b->buf, &b->m.alc);
+    luaL_getmetatable(L, WRITER_MT);
+    lua_setmetatable(L, -2);
+    if (size > 0 && !strbuf_reserve(&b->buf, (size_t)size)) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        return 2;
+    }
+    return 1;
+}
+
+static inline void init_writer_mt(lua_State *L)
+{
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       buffer_gc          },
+        {"__len",      writer_len_lua     },
+        {"__tostring", writer_tostring_lua},
+        {NULL,         NULL               }
+    };
+    struct luaL_Reg methods[] = {
+        {"encode", writer_encode_lua},
+        {"reset",  writer_reset_lua },
+        {NULL,     NULL             }
+    };
+
+    luaL_newmetatable(L, WRITER_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_newtable(L);
+    for (struct luaL_Reg *ptr = methods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
+
+static int encode_call(lua_State *L)
+{
+    yyjson_write_flag flg = 0;
+    yyjson_write_err err  = {0};
+    yyjson_mut_doc *doc   = NULL;
+    size_t len            = 0;
+    const char *str       = NULL;
+    memalloc_t m          = {0};
+    encopt_t opt          = ENCOPT_DEFAULT;
+    statsreg_t *reg       = stats_get(L);
+    double t0             = 0;
+    double t1             = 0;
+    int direct            = 0;
+    int rc                = 3;
+
+    luaL_checkany(L, 1);
+    flg = lauxh_optflags(L, 3);
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 2);
+    // the options are parsed before the arena is acquired, so that the
+    // argument errors never leave the arena in use
+    optencopt(L, 2, &opt);
+    direct = optfield_boolean(L, 2, "direct", 0);
+    memalloc_init(&m, L, 2);
+
+    if (direct) {
+        // the values are written while traversing the tables, so the whole
+        // time is counted as the conversion time
+        t0 = stats_clock(reg);
+        rc = encode_direct(L, 1, flg, &m, &opt);
+        stats_record(&reg->encode, &m, 0, stats_clock(reg) - t0);
+        memalloc_dispose(&m);
+        return rc;
+    }
+
+    t0  = stats_clock(reg);
+    doc = todoc(L, 1, &m, &opt, &err);
+    t1  = stats_clock(reg);
+    if (!doc || !(str = yyjson_mut_write_opts(doc, flg, &m.alc, &len, &err))) {
+        lua_pushnil(L);
+        lua_pushstring(L, err.msg);
+        lua_pushinteger(L, err.code);
+    } else {
+        lua_pushlstring(L, str, len);
+        m.alc.free(m.alc.ctx, (void *)str);
+        rc = 1;
+    }
+    stats_record(&reg->encode, &m, stats_clock(reg) - t1, t1 - t0);
+    yyjson_mut_doc_free(doc);
+    memalloc_dispose(&m);
+
+    return rc;
+}
+
+static int encode_lua(lua_State *L)
+{
+    return arena_call(L, 2, encode_call);
+}
+
+static int encode_many_call(lua_State *L)
+{
+    yyjson_write_flag flg = lauxh_optflags(L, 3);
+    strbuf_t buf          = {0};
+    memalloc_t m          = {0};
+    encopt_t opt          = ENCOPT_DEFAULT;
+    statsreg_t *reg       = stats_get(L);
+    size_t n              = 0;
+    double t0             = 0;
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = lauxh_rawlen(L, 1);
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 2);
+    optencopt(L, 2, &opt);
+    memalloc_init(&m, L, 2);
+    lua_createtable(L, (int)n, 0);
+    // the errors table is created when the first error occurs
+    lua_pushnil(L);
+
+    // the output buffer is reused across the values, so the values are
+    // counted as a call
+    strbuf_init(&buf, &m.alc);
+    t0 = stats_clock(reg);
+    for (size_t i = 1; i <= n; i++) {
+        lua_rawgeti(L, 1, i);
+        buf.len = 0;
+        m.nomem = 0;
+        if (writer_encode(L, 5, &buf, flg, &m, &opt)) {
+            lua_remove(L, -3);
+            seterror(L, 4, i);
+        } else {
+            lua_pushlstring(L, buf.data, buf.len);
+            lua_rawseti(L, 3, i);
+        }
+        lua_settop(L, 4);
+    }
+    strbuf_free(&buf);
+    stats_record(&reg->encode, &m, 0, stats_clock(reg) - t0);
+    memalloc_dispose(&m);
+
+    return 2;
+}
+
+static int encode_many_lua(lua_State *L)
+{
+    return arena_call(L, 2, encode_many_call);
+}
+
+#define SINK_CHUNK_SIZE WRITER_FLUSH_SIZE
+
+typedef struct {
+    lua_State *L;
+    // index of the sink function
+    int fn;
+    // index of the slot that keeps the error message or the error object of
+    // the sink function until the call returns
+    int slot;
+    // the sink function raised an error
+    int raised;
+} sink_t;
+
+// pass the content of the buffer to the sink function by chunks, and remove
+// them from the buffer. the last partial chunk is passed only if all is set.
+static int sink_flush(sink_t *s, strbuf_t *b, int all, yyjson_write_err *err)
+{
+    lua_State *L = s->L;
+    size_t pos   = 0;
+    int rc       = 1;
+
+    while (pos < b->len && (all || b->len - pos >= SINK_CHUNK_SIZE)) {
+        size_t n = b->len - pos;
+
+        n = (n < SINK_CHUNK_SIZE) ? n : SINK_CHUNK_SIZE;
+        lua_pushvalue(L, s->fn);
+        lua_pushlstring(L, b->data + pos, n);
+        if (lua_pcall(L, 1, 2, 0)) {
+            lua_replace(L, s->slot);
+            s->raised = 1;
+            rc        = 0;
+            break;
+        } else if (!lua_toboolean(L, -2) &&
+                   (!lua_isnil(L, -2) || !lua_isnil(L, -1))) {
+            // sink returned false or nil with an error
+            err->code = YYJSON_WRITE_ERROR_FILE_WRITE;
+            err->msg  = "sink function returned false";
+            if (lua_isstring(L, -1)) {
+                lua_pushvalue(L, -1);
+                lua_replace(L, s->slot);
+                err->msg = lua_tostring(L, s->slot);
+            }
+            lua_pop(L, 2);
+            rc = 0;
+            break;
+        }
+        lua_pop(L, 2);
+        pos += n;
+    }
+    strbuf_consume(b, pos);
+    return rc;
+}
+
+static int writer_flushsink(writer_t *w)
+{
+    return sink_flush((sink_t *)w->ctx, w->buf, 0, &w->err);
+}
+
+// write the value at vidx to the sink function at idx by chunks while
+// traversing the tables, so the whole output is never held in memory.
+// returns 1 on success, 0 on failure, or -1 if the sink function raised an
+// error and the error object is on the top of the stack.
+static int write_sink(lua_State *L, int idx, int vidx, yyjson_write_flag flg,
+                      memalloc_t *m, const encopt_t *opt,
+                      yyjson_write_err *err)
+{
+    sink_t s = {
+        .L  = L,
+        .fn = idx,
+    };
+    strbuf_t buf = {0};
+    writer_t w;
+    int ok = 0;
+
+    lua_pushnil(L);
+    s.slot = lua_gettop(L);
+    strbuf_init(&buf, &m->alc);
+    writer_init(&w, &buf, flg, &m->alc, opt);
+    w.flush = writer_flushsink;
+    w.ctx   = &s;
+    ok      = writer_value(&w, L, vidx, 0) && sink_flush(&s, &buf, 1, &w.err);
+    tablepath_free(&w.path);
+    strbuf_free(&buf);
+
+    if (s.raised) {
+        lua_pushvalue(L, s.slot);
+        return -1;
+    } else if (ok && m->nomem) {
+        writer_nomem(&w);
+        ok = 0;
+    }
+    *err = w.err;
+    return ok;
+}
+
+static int encode_file_call(lua_State *L)
+{
+    yyjson_write_flag flg = 0;
+    yyjson_write_err err  = {0};
+    yyjson_mut_doc *doc   = NULL;
+    const char *path      = NULL;
+    FILE *fp              = NULL;
+    memalloc_t m          = {0};
+    encopt_t opt          = ENCOPT_DEFAULT;
+    statsreg_t *reg       = stats_get(L);
+    double t0             = 0;
+    double t1             = 0;
+    double t2             = 0;
+    int rc                = 0;
+
+    luaL_checkany(L, 1);
+    switch (lua_type(L, 2)) {
+    case LUA_TSTRING:
+        path = lua_tostring(L, 2);
+        break;
+    case LUA_TFUNCTION:
+        break;
+    default:
+        fp = checkfile(L, 2);
+    }
+    flg = lauxh_optflags(L, 4);
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 3);
+    optencopt(L, 3, &opt);
+    memalloc_init(&m, L, 3);
+
+    t0 = stats_clock(reg);
+    if (!path && !fp) {
+        // the values are written while traversing the tables, so the whole
+        // time is counted as the conversion time
+        rc = write_sink(L, 2, 1, flg, &m, &opt, &err);
+        t1 = t2 = stats_clock(reg);
+    } else {
+        doc = todoc(L, 1, &m, &opt, &err);
+        t1  = stats_clock(reg);
+        if (doc) {
+            if (path) {
+                rc = yyjson_mut_write_file(path, doc, flg, &m.alc, &err);
+            } else {
+                rc = yyjson_mut_write_fp(fp, doc, flg, &m.alc, &err);
+            }
+            yyjson_mut_doc_free(doc);
+        }
+        t2 = stats_clock(reg);
+    }
+    stats_record(&reg->encode, &m, t2 - t1, t1 - t0);
+    memalloc_dispose(&m);
+
+    if (rc == -1) {
+        // rethrow the error of the sink function
+        return lua_error(L);
+    } else if (!rc) {
+        lua_pushnil(L);
+        lua_pushstring(L, err.msg);
+        lua_pushinteger(L, err.code);
+        return 3;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int encode_file_lua(lua_State *L)
+{
+    return arena_call(L, 3, encode_file_call);
+}
+
+#define MUTDOC_MT "yyjson.mutdoc"
+
+// mutable document that is edited by the JSON Pointer and the JSON Patch,
+// and written back without converting the document to Lua values.
+typedef struct {
+    memalloc_t m;
+    yyjson_mut_doc *doc;
+} mutdoc_t;
+
+static inline int mutdoc_nomem(lua_State *L)
+{
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(ENOMEM));
+    lua_pushinteger(L, YYJSON_WRITE_ERROR_MEMORY_ALLOCATION);
+    return 3;
+}
+
+static inline int mutdoc_ptrerror(lua_State *L, yyjson_ptr_err *err)
+{
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s at %d", err->msg, (int)err->pos);
+    lua_pushinteger(L, err->code);
+    return 3;
+}
+
+// convert the Lua value at idx to the value of the document. if parse is
+// true, the string is parsed as a JSON. on failure, it pushes nil, the error
+// message and the error number, and returns NULL.
+static yyjson_mut_val *mutdoc_toval(lua_State *L, mutdoc_t *d, int idx,
+                                    int parse)
+{
+    yyjson_mut_val *val = NULL;
+    tablepath_t path;
+
+    if (parse && lua_type(L, idx) == LUA_TSTRING) {
+        size_t len          = 0;
+        const char *str     = lua_tolstring(L, idx, &len);
+        yyjson_read_err err = {0};
+        yyjson_doc *doc     = yyjson_read_opts((char *)str, len, 0, &d->m.alc,
+                                               &err);
+        if (!doc) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s at %d", err.msg, (int)err.pos);
+            lua_pushinteger(L, err.code);
+            return NULL;
+        }
+        val = yyjson_val_mut_copy(d->doc, yyjson_doc_get_root(doc));
+        yyjson_doc_free(doc);
+        if (!val) {
+            mutdoc_nomem(L);
+        }
+        return val;
+    }
+
+    d->m.nomem = 0;
+    tablepath_init(&path, &d->m.alc, &ENCOPT_DEFAULT);
+    // the document keeps the strings after the Lua values are collected
+    path.copy = 1;
+    val       = tovalue(d->doc, L, idx, &path);
+    tablepath_free(&path);
+    if (path.errmsg && !d->m.nomem) {
+        lua_pushnil(L);
+        lua_pushstring(L, path.errmsg);
+        lua_pushinteger(L, path.code);
+        return NULL;
+    } else if (d->m.nomem || (!val && !(val = yyjson_mut_null(d->doc)))) {
+        mutdoc_nomem(L);
+        return NULL;
+    }
+    return val;
+}
+
+static int mutdoc_get_lua(lua_State *L)
+{
+    mutdoc_t *d         = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    size_t len          = 0;
+    const char *ptr     = lauxh_checklstring(L, 2, &len);
+    pushctx_t ctx       = {0};
+    yyjson_ptr_err perr = {0};
+    yyjson_mut_val *val = NULL;
+    yyjson_doc *doc     = NULL;
+    int rc              = 0;
+
+    ctx.with_null = lauxh_optboolean(L, 3, 0);
+    ctx.with_ref  = lauxh_optboolean(L, 4, 0);
+    lua_settop(L, 2);
+    if (!(val = yyjson_mut_doc_ptr_getx(d->doc, ptr, len, NULL, &perr))) {
+        return mutdoc_ptrerror(L, &perr);
+    }
+    // the value is copied to the immutable document to push it
+    if (!(doc = yyjson_mut_val_imut_copy(val, &d->m.alc))) {
+        return mutdoc_nomem(L);
+    }
+    rc = pushvalue(L, 2, yyjson_doc_get_root(doc), &ctx);
+    yyjson_doc_free(doc);
+    return rc;
+}
+
+static int mutdoc_set_lua(lua_State *L)
+{
+    mutdoc_t *d         = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    size_t len          = 0;
+    const char *ptr     = lauxh_checklstring(L, 2, &len);
+    int create_parent   = lauxh_optboolean(L, 4, 0);
+    yyjson_ptr_err perr = {0};
+    yyjson_mut_val *val = NULL;
+
+    luaL_checkany(L, 3);
+    lua_settop(L, 3);
+    if (!(val = mutdoc_toval(L, d, 3, 0))) {
+        return 3;
+    } else if (!yyjson_mut_doc_ptr_setx(d->doc, ptr, len, val, create_parent,
+                                        NULL, &perr)) {
+        return mutdoc_ptrerror(L, &perr);
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int mutdoc_remove_lua(lua_State *L)
+{
+    mutdoc_t *d         = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    size_t len          = 0;
+    const char *ptr     = lauxh_checklstring(L, 2, &len);
+    yyjson_ptr_err perr = {0};
+
+    if (!yyjson_mut_doc_ptr_removex(d->doc, ptr, len, NULL, &perr)) {
+        return mutdoc_ptrerror(L, &perr);
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// apply the JSON Patch (RFC 6902)
+static int mutdoc_patch_lua(lua_State *L)
+{
+    mutdoc_t *d           = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    yyjson_patch_err perr = {0};
+    yyjson_mut_val *patch = NULL;
+    yyjson_mut_val *root  = NULL;
+
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    if (!(patch = mutdoc_toval(L, d, 2, 1))) {
+        return 3;
+    }
+    root = yyjson_mut_patch(d->doc, yyjson_mut_doc_get_root(d->doc), patch,
+                            &perr);
+    if (!root) {
+        lua_pushnil(L);
+        if (perr.ptr.code) {
+            lua_pushfstring(L, "%s at %d of the operation #%d", perr.ptr.msg,
+                            (int)perr.ptr.pos, (int)perr.idx + 1);
+        } else {
+            lua_pushfstring(L, "%s at the operation #%d", perr.msg,
+                            (int)perr.idx + 1);
+        }
+        lua_pushinteger(L, perr.code);
+        return 3;
+    }
+    yyjson_mut_doc_set_root(d->doc, root);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// apply the JSON Merge Patch (RFC 7386)
+static int mutdoc_merge_patch_lua(lua_State *L)
+{
+    mutdoc_t *d           = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    yyjson_mut_val *patch = NULL;
+    yyjson_mut_val *root  = NULL;
 
-static int object_tostring_lua(lua_State *L)
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    if (!(patch = mutdoc_toval(L, d, 2, 1))) {
+        return 3;
+    }
+    root = yyjson_mut_merge_patch(d->doc, yyjson_mut_doc_get_root(d->doc),
+                                  patch);
+    if (!root) {
+        return mutdoc_nomem(L);
+    }
+    yyjson_mut_doc_set_root(d->doc, root);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int mutdoc_encode_lua(lua_State *L)
 {
-    tostring_lua(L, AS_OBJECT_MT);
+    mutdoc_t *d           = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    yyjson_write_flag flg = lauxh_optflags(L, 2);
+    yyjson_write_err err  = {0};
+    size_t len            = 0;
+    char *str = yyjson_mut_write_opts(d->doc, flg, &d->m.alc, &len, &err);
+
+    if (!str) {
+        lua_pushnil(L);
+        lua_pushstring(L, err.msg);
+        lua_pushinteger(L, err.code);
+        return 3;
+    }
+    lua_pushlstring(L, str, len);
+    d->m.alc.free(d->m.alc.ctx, str);
     return 1;
 }
 
-static int array_tostring_lua(lua_State *L)
+static int mutdoc_len_lua(lua_State *L)
 {
-    tostring_lua(L, AS_ARRAY_MT);
+    mutdoc_t *d = (mutdoc_t *)luaL_checkudata(L, 1, MUTDOC_MT);
+    lua_pushinteger(L, d->m.usesize);
     return 1;
 }
 
-static int null_tostring_lua(lua_State *L)
+static int mutdoc_tostring_lua(lua_State *L)
 {
-    tostring_lua(L, AS_NULL_MT);
+    lua_pushfstring(L, MUTDOC_MT ": %p", luaL_checkudata(L, 1, MUTDOC_MT));
     return 1;
 }
 
-static inline void init_aux_objects(lua_State *L)
+static int mutdoc_gc(lua_State *L)
 {
-    // create auxiliary object metatables
-    AS_OBJECT = lua_newuserdata(L, 0);
-    luaL_newmetatable(L, AS_OBJECT_MT);
-    lauxh_pushfn2tbl(L, "__tostring", object_tostring_lua);
-    lua_setmetatable(L, -2);
-    AS_OBJECT_REF = lauxh_ref(L);
+    mutdoc_t *d = (mutdoc_t *)lua_touserdata(L, 1);
 
-    AS_ARRAY = lua_newuserdata(L, 0);
-    luaL_newmetatable(L, AS_ARRAY_MT);
-    lauxh_pushfn2tbl(L, "__tostring", array_tostring_lua);
-    lua_setmetatable(L, -2);
-    AS_ARRAY_REF = lauxh_ref(L);
+    if (d->doc) {
+        yyjson_mut_doc_free(d->doc);
+        d->doc = NULL;
+    }
+    return 0;
+}
 
-    AS_NULL = lua_newuserdata(L, 0);
-    luaL_newmetatable(L, AS_NULL_MT);
-    lauxh_pushfn2tbl(L, "__tostring", null_tostring_lua);
+static int mutdoc_lua(lua_State *L)
+{
+    size_t len           = 0;
+    const char *str      = lauxh_checklstring(L, 1, &len);
+    lua_Integer maxsize  = lauxh_optinteger(L, 2, 0);
+    yyjson_read_flag flg = lauxh_optflags(L, 3);
+    yyjson_read_err err  = {0};
+    yyjson_doc *doc      = NULL;
+    mutdoc_t *d          = NULL;
+
+    if (flg & YYJSON_READ_INSITU) {
+        // Lua strings are never parsed in-situ
+        len = (len < YYJSON_PADDING_SIZE) ? 0 : len - YYJSON_PADDING_SIZE;
+        flg &= ~YYJSON_READ_INSITU;
+    }
+    d      = (mutdoc_t *)lua_newuserdata(L, sizeof(mutdoc_t));
+    d->doc = NULL;
+    memalloc_setup(&d->m, L, NULL, (maxsize < 0) ? 0 : (size_t)maxsize);
+    luaL_getmetatable(L, MUTDOC_MT);
     lua_setmetatable(L, -2);
-    AS_NULL_REF = lauxh_ref(L);
+
+    // the strings are copied to the mutable document, so the immutable
+    // document is released after copying
+    if (!(doc = yyjson_read_opts((char *)str, len, flg, &d->m.alc, &err))) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s at %d", err.msg, (int)err.pos);
+        lua_pushinteger(L, err.code);
+        return 3;
+    }
+    d->doc = yyjson_doc_mut_copy(doc, &d->m.alc);
+    yyjson_doc_free(doc);
+    if (!d->doc) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(ENOMEM));
+        lua_pushinteger(L, YYJSON_READ_ERROR_MEMORY_ALLOCATION);
+        return 3;
+    }
+    return 1;
 }
 
-static int pushvalue(lua_State *L, yyjson_val *val, int with_null, int with_ref)
+static inline void init_mutdoc_mt(lua_State *L)
 {
-    switch (yyjson_get_type(val)) {
-    case YYJSON_TYPE_NULL:
-        if (with_null) {
-            lauxh_pushref(L, AS_NULL_REF);
-            return 1;
-        }
-    case YYJSON_TYPE_NONE:
-        lua_pushnil(L);
-        return 1;
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       mutdoc_gc          },
+        {"__len",      mutdoc_len_lua     },
+        {"__tostring", mutdoc_tostring_lua},
+        {NULL,         NULL               }
+    };
+    struct luaL_Reg methods[] = {
+        {"get",         mutdoc_get_lua        },
+        {"set",         mutdoc_set_lua        },
+        {"remove",      mutdoc_remove_lua     },
+        {"patch",       mutdoc_patch_lua      },
+        {"merge_patch", mutdoc_merge_patch_lua},
+        {"encode",      mutdoc_encode_lua     },
+        {NULL,          NULL                  }
+    };
 
-    case YYJSON_TYPE_BOOL:
-        lua_pushboolean(L, yyjson_get_bool(val));
-        return 1;
+    luaL_newmetatable(L, MUTDOC_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_newtable(L);
+    for (struct luaL_Reg *ptr = methods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
+    }
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+}
 
-    case YYJSON_TYPE_NUM:
-        switch (yyjson_get_subtype(val)) {
-        case YYJSON_SUBTYPE_UINT:
-            lua_pushinteger(L, yyjson_get_uint(val));
-            break;
-        case YYJSON_SUBTYPE_SINT:
-            lua_pushinteger(L, yyjson_get_sint(val));
-            break;
-        case YYJSON_SUBTYPE_REAL:
-            lua_pushnumber(L, yyjson_get_real(val));
-            break;
-        }
-        return 1;
+#define ENCODER_MT "yyjson.encoder"
 
-    case YYJSON_TYPE_STR:
-        lua_pushstring(L, yyjson_get_str(val));
-        return 1;
+typedef enum {
+    FIELD_ANY = 0,
+    FIELD_BOOLEAN,
+    FIELD_INTEGER,
+    FIELD_NUMBER,
+    FIELD_STRING,
+    FIELD_RECORD,
+} fieldtype_t;
 
-    case YYJSON_TYPE_ARR: {
-        int rc             = 0;
-        yyjson_arr_iter it = {0};
+static const char *const FIELD_TYPES[] = {
+    "any", "boolean", "integer", "number", "string", "table", NULL,
+};
 
-        yyjson_arr_iter_init(val, &it);
-        if (!lua_checkstack(L, 2)) {
-            lua_settop(L, 0);
-            lua_pushnil(L);
-            lua_pushliteral(L, "out of stack space");
-            return 2;
-        }
-        lua_createtable(L, it.max, 0);
-        if (with_ref) {
-            lauxh_pushref(L, AS_ARRAY_REF);
-            lua_rawseti(L, -2, -1);
-        }
-        while ((val = yyjson_arr_iter_next(&it))) {
-            if ((rc = pushvalue(L, val, with_null, with_ref)) > 1) {
-                return rc;
-            }
-            lua_rawseti(L, -2, it.idx);
-        }
+typedef struct encoder_s encoder_t;
+
+typedef struct {
+    // field name is kept alive by the reference table of the encoder
+    const char *name;
+    size_t len;
+    fieldtype_t type;
+    encoder_t *enc;
+} field_t;
+
+// precompiled field layout of the record.
+// the fields are looked up in the fixed order.
+struct encoder_s {
+    int ref;
+    size_t nfield;
+    field_t fields[];
+};
+
+// returns 1 if the value at idx matches the type of the field. the value of
+// FIELD_RECORD is checked by writer_record.
+static int fieldmatch(lua_State *L, int idx, fieldtype_t type)
+{
+    switch (type) {
+    case FIELD_BOOLEAN:
+        return lua_type(L, idx) == LUA_TBOOLEAN;
+    case FIELD_INTEGER:
+        return lua_type(L, idx) == LUA_TNUMBER && lauxh_isinteger(L, idx);
+    case FIELD_NUMBER:
+        return lua_type(L, idx) == LUA_TNUMBER;
+    case FIELD_STRING:
+        return lua_type(L, idx) == LUA_TSTRING;
+    // case FIELD_ANY:
+    // case FIELD_RECORD:
+    default:
         return 1;
     }
+}
+
+// write the table at idx as an object that has the fields of the encoder in
+// order. the fields that are nil or cannot be encoded are omitted.
+// on failure, it returns 0 and the error message is pushed onto the stack.
+static int writer_record(writer_t *w, lua_State *L, int idx, encoder_t *enc,
+                         int depth)
+{
+    size_t n = 0;
+
+    if (lua_type(L, idx) != LUA_TTABLE) {
+        lua_pushfstring(L, "table expected, got %s", luaL_typename(L, idx));
+        w->err.code = YYJSON_WRITE_ERROR_INVALID_VALUE_TYPE;
+        return 0;
+    } else if (!lua_checkstack(L, 3)) {
+        writer_nomem(w);
+        goto FAIL;
+    }
+    // the record table is on the path while its fields are written
+    if (!tablepath_push(&w->path, L, idx)) {
+        lua_pushstring(L, w->path.errmsg);
+        w->err.code = w->path.code;
+        return 0;
+    } else if (!writer_char(w, '{')) {
+        goto FAIL;
+    }
 
-    case YYJSON_TYPE_OBJ: {
-        int rc             = 0;
-        yyjson_obj_iter it = {0};
-        yyjson_val *key    = NULL;
+    for (size_t i = 0; i < enc->nfield; i++) {
+        field_t *f = &enc->fields[i];
+        int vidx   = 0;
 
-        yyjson_obj_iter_init(val, &it);
-        if (!lua_checkstack(L, 3)) {
-            lua_settop(L, 0);
-            lua_pushnil(L);
-            lua_pushliteral(L, "out of stack space");
-            return 2;
-        }
-        lua_createtable(L, 0, it.max);
-        if (with_ref) {
-            lauxh_pushref(L, AS_OBJECT_REF);
-            lua_rawseti(L, -2, -1);
+        // the fields are looked up without the metamethods, so no Lua code
+        // runs while the arena and the buffers are in use
+        lua_pushlstring(L, f->name, f->len);
+        lua_rawget(L, idx);
+        vidx = lua_gettop(L);
+        if (lua_isnil(L, vidx) ||
+            (f->type == FIELD_ANY && !isencodable(L, vidx))) {
+            lua_pop(L, 1);
+            continue;
+        } else if (!fieldmatch(L, vidx, f->type)) {
+            lua_pushfstring(L, "field '%s': %s expected, got %s", f->name,
+                            FIELD_TYPES[f->type], luaL_typename(L, vidx));
+            w->err.code = YYJSON_WRITE_ERROR_INVALID_VALUE_TYPE;
+            return 0;
+        } else if ((n++ && !writer_char(w, ',')) ||
+                   !writer_newline(w, depth + 1) ||
+                   !writer_string(w, f->name, f->len) ||
+                   !writer_raw(w, ": ", (w->indent) ? 2 : 1)) {
+            goto FAIL;
         }
-        while ((key = yyjson_obj_iter_next(&it))) {
-            val = yyjson_obj_iter_get_val(key);
-            if ((rc = pushvalue(L, val, with_null, with_ref)) > 1) {
-                return rc;
+
+        if (f->type == FIELD_RECORD) {
+            if (!writer_record(w, L, vidx, f->enc, depth + 1)) {
+                if (w->err.code != YYJSON_WRITE_ERROR_MEMORY_ALLOCATION) {
+                    // prefix the field name to the error message
+                    lua_pushfstring(L, "field '%s': %s", f->name,
+                                    lua_tostring(L, -1));
+                }
+                return 0;
+            }
+        } else if (!writer_value(w, L, vidx, depth + 1)) {
+            if (w->err.code == YYJSON_WRITE_ERROR_MEMORY_ALLOCATION) {
+                goto FAIL;
             }
-            lua_setfield(L, -2, yyjson_get_str(key));
+            lua_pushfstring(L, "field '%s': %s", f->name, w->err.msg);
+            return 0;
         }
-        return 1;
+        lua_pop(L, 1);
     }
 
-    default:
-        // unknown type
-        lua_settop(L, 0);
-        lua_pushnil(L);
-        lua_pushfstring(L, "unknown value type %d", yyjson_get_type(val));
-        return 2;
+    if ((n && !writer_newline(w, depth)) || !writer_char(w, '}')) {
+        goto FAIL;
     }
+    tablepath_pop(&w->path);
+    return 1;
+
+FAIL:
+    lua_pushstring(L, w->err.msg);
+    return 0;
 }
 
-static int decode_lua(lua_State *L)
+// the record is written by the direct writer with the field plan of the
+// encoder, so no yyjson_mut_doc is built.
+static int encoder_encode_call(lua_State *L)
 {
-    size_t len           = 0;
-    const char *str      = lauxh_checklstring(L, 1, &len);
-    int with_null        = lauxh_optboolean(L, 2, 0);
-    int with_ref         = lauxh_optboolean(L, 3, 0);
-    lua_Integer maxsize  = lauxh_optinteger(L, 4, 0);
-    yyjson_read_flag flg = lauxh_optflags(L, 5);
-    yyjson_read_err err  = {0};
-    yyjson_doc *doc      = NULL;
-    memalloc_t m         = {0};
-    int rc               = 3;
+    encoder_t *enc        = (encoder_t *)luaL_checkudata(L, 1, ENCODER_MT);
+    yyjson_write_flag flg = 0;
+    strbuf_t buf          = {0};
+    memalloc_t m          = {0};
+    encopt_t opt          = ENCOPT_DEFAULT;
+    statsreg_t *reg       = stats_get(L);
+    double t0             = 0;
+    writer_t w;
+    int ok = 0;
+    int rc = 3;
 
-    lua_settop(L, 1);
-    memalloc_init(&m, L, (maxsize < 0) ? 0 : (size_t)maxsize);
-    if (flg & YYJSON_READ_INSITU) {
-        len -= YYJSON_PADDING_SIZE;
-    }
-    doc = yyjson_read_opts((char *)str, len, flg, &m.alc, &err);
-    if (doc) {
-        rc = pushvalue(L, yyjson_doc_get_root(doc), with_null, with_ref);
-        if (rc == 1) {
-            lua_pushnil(L);
-            lua_pushnil(L);
-            lua_pushinteger(L, yyjson_doc_get_read_size(doc));
-            rc = 4;
+    luaL_checkany(L, 2);
+    flg = lauxh_optflags(L, 4);
+    // keep the arena on the stack until the call is finished
+    lua_settop(L, 3);
+    optencopt(L, 3, &opt);
+    memalloc_init(&m, L, 3);
+    strbuf_init(&buf, &m.alc);
+    writer_init(&w, &buf, flg, &m.alc, &opt);
+
+    // the record is written directly, so the whole time is counted as the
+    // conversion time
+    t0 = stats_clock(reg);
+    ok = writer_record(&w, L, 2, enc, 0);
+    if (!ok || m.nomem) {
+        if (m.nomem) {
+            lua_pushstring(L, strerror(ENOMEM));
+            w.err.code = YYJSON_WRITE_ERROR_MEMORY_ALLOCATION;
         }
-        yyjson_doc_free(doc);
-    } else {
         lua_pushnil(L);
-        lua_pushfstring(L, "%s at %d", err.msg, err.pos);
-        lua_pushinteger(L, err.code);
+        lua_insert(L, -2);
+        lua_pushinteger(L, w.err.code);
+    } else {
+        lua_pushlstring(L, buf.data, buf.len);
+        rc = 1;
     }
+    tablepath_free(&w.path);
+    strbuf_free(&buf);
+    stats_record(&reg->encode, &m, 0, stats_clock(reg) - t0);
     memalloc_dispose(&m);
 
     return rc;
 }
 
-static yyjson_mut_val *tovalue(yyjson_mut_doc *doc, lua_State *L, int idx)
+static int encoder_encode_lua(lua_State *L)
 {
-    switch (lua_type(L, idx)) {
-    case LUA_TNIL:
-        return yyjson_mut_null(doc);
+    return arena_call(L, 3, encoder_encode_call);
+}
 
-    case LUA_TBOOLEAN:
-        return yyjson_mut_bool(doc, lua_toboolean(L, idx));
+static int encoder_gc(lua_State *L)
+{
+    encoder_t *enc = (encoder_t *)lua_touserdata(L, 1);
+    enc->ref       = lauxh_unref(L, enc->ref);
+    return 0;
+}
 
-    case LUA_TNUMBER:
-        if (lauxh_isinteger(L, idx)) {
-            lua_Integer ival = lua_tointeger(L, idx);
-            if (ival > 0) {
-                return yyjson_mut_uint(doc, ival);
-            }
-            return yyjson_mut_sint(doc, ival);
-        }
-        return yyjson_mut_real(doc, lua_tonumber(L, idx));
+static int encoder_len_lua(lua_State *L)
+{
+    encoder_t *enc = (encoder_t *)luaL_checkudata(L, 1, ENCODER_MT);
+    lua_pushinteger(L, enc->nfield);
+    return 1;
+}
 
-    case LUA_TSTRING: {
-        size_t len      = 0;
-        const char *str = lua_tolstring(L, idx, &len);
-        return yyjson_mut_strn(doc, str, len);
-    }
+static int encoder_tostring_lua(lua_State *L)
+{
+    lua_pushfstring(L, ENCODER_MT ": %p", luaL_checkudata(L, 1, ENCODER_MT));
+    return 1;
+}
 
-    case LUA_TTABLE: {
-        yyjson_mut_val *bin = NULL;
+static int compile_encoder_lua(lua_State *L)
+{
+    size_t n       = 0;
+    int nref       = 0;
+    encoder_t *enc = NULL;
 
-        // if the -1st element of a table is AS_ARRAY or AS_OBJECT, the table is
-        // treated as that data type.
-        lua_rawgeti(L, idx, -1);
-        if (lua_type(L, -1) == LUA_TUSERDATA) {
-            const void *ptr = lua_topointer(L, -1);
-            lua_pop(L, 1);
-            if (ptr == AS_OBJECT) {
-                goto TREAT_AS_OBJECT;
-            } else if (ptr == AS_ARRAY) {
-                goto TREAT_AS_ARRAY;
-            }
-        }
-        lua_pop(L, 1);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    n   = lauxh_rawlen(L, 1);
+    enc = (encoder_t *)lua_newuserdata(L, sizeof(encoder_t) +
+                                              sizeof(field_t) * n);
+    enc->ref    = LUA_NOREF;
+    enc->nfield = 0;
+    luaL_getmetatable(L, ENCODER_MT);
+    lua_setmetatable(L, -2);
 
-        // as array
-        if (lauxh_rawlen(L, idx)) {
-            lua_Integer prev = 0;
+    // the field names and the nested encoders are referenced by this table
+    lua_createtable(L, (int)n * 2, 0);
+    for (size_t i = 1; i <= n; i++) {
+        field_t *f = &enc->fields[i - 1];
 
-TREAT_AS_ARRAY:
-            if (!(bin = yyjson_mut_arr(doc))) {
-                // failed to alloc memory
-                return NULL;
-            }
-            lua_pushnil(L);
-            while (lua_next(L, idx) != 0) {
-                lua_Integer i       = 0;
-                yyjson_mut_val *val = NULL;
-
-                if (lauxh_isinteger(L, -2) && (i = lua_tointeger(L, -2)) > 0 &&
-                    (val = tovalue(doc, L, lua_gettop(L)))) {
-                    if (i < prev) {
-                        yyjson_mut_arr_insert(bin, val, (size_t)i - 1);
-                    } else {
-                        lua_Integer skip = i - prev;
-                        // fill spaces
-                        for (lua_Integer n = 1; n < skip; n++) {
-                            yyjson_mut_val *nullval = yyjson_mut_null(doc);
-                            if (!val) {
-                                // failed to alloc memory
-                                return NULL;
-                            }
-                            yyjson_mut_arr_append(bin, nullval);
-                        }
-                        yyjson_mut_arr_append(bin, val);
-                        prev = i;
-                    }
-                }
-                lua_pop(L, 1);
-            }
-            return bin;
+        *f = (field_t){0};
+        lua_rawgeti(L, 1, i);
+        if (lua_type(L, 4) != LUA_TTABLE) {
+            return luaL_argerror(
+                L, 1, lua_pushfstring(L, "field #%d must be table", (int)i));
         }
-
-TREAT_AS_OBJECT:
-        // as object
-        if (!(bin = yyjson_mut_obj(doc))) {
-            // failed to alloc memory
-            return NULL;
+        lua_rawgeti(L, 4, 1);
+        lua_rawgeti(L, 4, 2);
+        if (lua_type(L, 5) != LUA_TSTRING) {
+            return luaL_argerror(
+                L, 1,
+                lua_pushfstring(L, "field #%d name must be string", (int)i));
         }
-        lua_pushnil(L);
-        while (lua_next(L, idx) != 0) {
-            yyjson_mut_val *val = NULL;
+        f->name = lua_tolstring(L, 5, &f->len);
+        if (strlen(f->name) != f->len) {
+            return luaL_argerror(
+                L, 1,
+                lua_pushfstring(L, "field #%d name must not contain NUL",
+                                (int)i));
+        }
+        lua_pushvalue(L, 5);
+        lua_rawseti(L, 3, ++nref);
 
-            if (lua_type(L, -2) == LUA_TSTRING &&
-                (val = tovalue(doc, L, lua_gettop(L)))) {
-                yyjson_mut_val *key = tovalue(doc, L, lua_gettop(L) - 1);
-                if (!key) {
-                    // failed to alloc memory
-                    return NULL;
+        if (lauxh_isuserdataof(L, 6, ENCODER_MT)) {
+            f->type = FIELD_RECORD;
+            f->enc  = (encoder_t *)lua_touserdata(L, 6);
+            lua_pushvalue(L, 6);
+            lua_rawseti(L, 3, ++nref);
+        } else if (lua_isnil(L, 6)) {
+            f->type = FIELD_ANY;
+        } else {
+            const char *type = lua_tostring(L, 6);
+            // FIELD_RECORD is never specified by the name
+            f->type          = FIELD_RECORD;
+            for (int t = FIELD_ANY; type && t < FIELD_RECORD; t++) {
+                if (strcmp(type, FIELD_TYPES[t]) == 0) {
+                    f->type = (fieldtype_t)t;
+                    break;
                 }
-                yyjson_mut_obj_add(bin, key, val);
             }
-            lua_pop(L, 1);
+            if (lua_type(L, 6) != LUA_TSTRING || f->type == FIELD_RECORD) {
+                return luaL_argerror(
+                    L, 1,
+                    lua_pushfstring(L,
+                                    "field #%d type must be 'any', "
+                                    "'boolean', 'integer', 'number', "
+                                    "'string' or yyjson.encoder",
+                                    (int)i));
+            }
         }
-        return bin;
+        lua_settop(L, 3);
+        enc->nfield++;
     }
+    enc->ref = lauxh_ref(L);
 
-    case LUA_TUSERDATA:
-        if (lauxh_isuserdataof(L, idx, AS_NULL_MT)) {
-            return yyjson_mut_null(doc);
-        }
-
-    // case LUA_TLIGHTUSERDATA:
-    // case LUA_TFUNCTION:
-    // case LUA_TTHREAD:
-    default:
-        return NULL;
-    }
+    return 1;
 }
 
-static int encode_lua(lua_State *L)
+static inline void init_encoder_mt(lua_State *L)
 {
-    yyjson_read_flag flg = 0;
-    yyjson_write_err err = {0};
-    yyjson_mut_doc *doc  = NULL;
-    yyjson_mut_val *val  = NULL;
-    size_t len           = 0;
-    const char *str      = NULL;
-    lua_Integer maxsize  = 0;
-    memalloc_t m         = {0};
-    int rc               = 3;
-
-    luaL_checkany(L, 1);
-    maxsize = lauxh_optinteger(L, 2, 0);
-    flg     = lauxh_optflags(L, 3);
-    memalloc_init(&m, L, (maxsize < 0) ? 0 : (size_t)maxsize);
-
-    doc = yyjson_mut_doc_new(&m.alc);
-    if (!doc) {
-        err.msg  = strerror(ENOMEM);
-        err.code = YYJSON_READ_ERROR_MEMORY_ALLOCATION;
-        goto FAIL;
-    }
-
-    lua_settop(L, 1);
-    val = tovalue(doc, L, 1);
-    if (m.nomem || (!val && !(val = yyjson_mut_null(doc)))) {
-        err.msg  = strerror(ENOMEM);
-        err.code = YYJSON_READ_ERROR_MEMORY_ALLOCATION;
-        goto FAIL;
-    }
-    yyjson_mut_doc_set_root(doc, val);
+    struct luaL_Reg mmethods[] = {
+        {"__gc",       encoder_gc          },
+        {"__len",      encoder_len_lua     },
+        {"__tostring", encoder_tostring_lua},
+        {NULL,         NULL                }
+    };
 
-    str = yyjson_mut_write_opts(doc, flg, &m.alc, &len, &err);
-    if (!str) {
-FAIL:
-        lua_settop(L, 0);
-        lua_pushnil(L);
-        lua_pushstring(L, err.msg);
-        lua_pushinteger(L, err.code);
-    } else {
-        lua_pushlstring(L, str, len);
-        m.alc.free(m.alc.ctx, (void *)str);
-        rc = 1;
+    luaL_newmetatable(L, ENCODER_MT);
+    for (struct luaL_Reg *ptr = mmethods; ptr->name; ptr++) {
+        lauxh_pushfn2tbl(L, ptr->name, ptr->func);
     }
-    yyjson_mut_doc_free(doc);
-    memalloc_dispose(&m);
-
-    return rc;
+    lua_newtable(L);
+    pushstatsfn2tbl(L, "encode", encoder_encode_lua);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
 }
 
 LUALIB_API int luaopen_yyjson(lua_State *L)
 {
     init_aux_objects(L);
+    init_stats(L);
+    init_raw_mt(L);
+    init_arena_mt(L);
+    init_view_mt(L);
+    init_buffer_mt(L);
+    init_encoder_mt(L);
+    init_writer_mt(L);
+    init_async_mt(L);
+    init_decoder_mt(L);
+    init_mutdoc_mt(L);
 
     lua_createtable(L, 0, 2);
     // export symbols
@@ -541,8 +5440,28 @@ LUALIB_API int luaopen_yyjson(lua_State *L)
     lua_setfield(L, -2, "NULL");
 
     // export functions
-    lauxh_pushfn2tbl(L, "encode", encode_lua);
-    lauxh_pushfn2tbl(L, "decode", decode_lua);
+    pushstatsfn2tbl(L, "stats", stats_lua);
+    lauxh_pushfn2tbl(L, "raw", raw_lua);
+    lauxh_pushfn2tbl(L, "as_array", as_array_lua);
+    lauxh_pushfn2tbl(L, "as_object", as_object_lua);
+    pushstatsfn2tbl(L, "encode", encode_lua);
+    pushstatsfn2tbl(L, "encode_many", encode_many_lua);
+    pushstatsfn2tbl(L, "encode_file", encode_file_lua);
+    lauxh_pushfn2tbl(L, "compile_encoder", compile_encoder_lua);
+    pushstatsfn2tbl(L, "decode", decode_lua);
+    lauxh_pushfn2tbl(L, "decode_iter", decode_iter_lua);
+    pushstatsfn2tbl(L, "decode_many", decode_many_lua);
+    lauxh_pushfn2tbl(L, "decode_parallel", decode_parallel_lua);
+    lauxh_pushfn2tbl(L, "decode_async", decode_async_lua);
+    lauxh_pushfn2tbl(L, "decoder", decoder_lua);
+    lauxh_pushfn2tbl(L, "mutdoc", mutdoc_lua);
+    pushstatsfn2tbl(L, "decode_file", decode_file_lua);
+    lauxh_pushfn2tbl(L, "arena", arena_lua);
+    lauxh_pushfn2tbl(L, "buffer", buffer_lua);
+    lauxh_pushfn2tbl(L, "writer", writer_lua);
+    lauxh_pushfn2tbl(L, "parse", parse_lua);
+    pushstatsfn2tbl(L, "get", get_lua);
+    lauxh_pushfn2tbl(L, "pairs", pairs_lua);
 
     /** Options for JSON reader. */
     /** Default option (RFC 8259 compliant):
@@ -637,6 +5556,24 @@ LUALIB_API int luaopen_yyjson(lua_State *L)
     /** Failed to read a file. */
     lauxh_pushint2tbl(L, "READ_ERROR_FILE_READ", YYJSON_READ_ERROR_FILE_READ);
 
+    /** Result code for JSON pointer. */
+    /** No JSON pointer error. */
+    lauxh_pushint2tbl(L, "PTR_ERR_NONE", YYJSON_PTR_ERR_NONE);
+    /** Invalid input parameter, such as NULL input. */
+    lauxh_pushint2tbl(L, "PTR_ERR_PARAMETER", YYJSON_PTR_ERR_PARAMETER);
+    /** JSON pointer syntax error, such as invalid escape, token no prefix. */
+    lauxh_pushint2tbl(L, "PTR_ERR_SYNTAX", YYJSON_PTR_ERR_SYNTAX);
+    /** JSON pointer resolve failed, such as index out of range, key not found.
+     */
+    lauxh_pushint2tbl(L, "PTR_ERR_RESOLVE", YYJSON_PTR_ERR_RESOLVE);
+    /** Document's root is NULL, but it is required for the function call. */
+    lauxh_pushint2tbl(L, "PTR_ERR_NULL_ROOT", YYJSON_PTR_ERR_NULL_ROOT);
+    /** Cannot set root as the target is not a document. */
+    lauxh_pushint2tbl(L, "PTR_ERR_SET_ROOT", YYJSON_PTR_ERR_SET_ROOT);
+    /** The memory allocation failed and a new value could not be created. */
+    lauxh_pushint2tbl(L, "PTR_ERR_MEMORY_ALLOCATION",
+                      YYJSON_PTR_ERR_MEMORY_ALLOCATION);
+
     /** Options for JSON writer. */
     /** Default option:
         - Write JSON minify.
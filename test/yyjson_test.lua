@@ -76,6 +76,128 @@ function testcase.encode_decode()
     end
 end
 
+function testcase.stats()
+    -- test that the statistics are cleared by the reset argument
+    yyjson.stats(true)
+    local stats = yyjson.stats()
+    for _, kind in ipairs({
+        'decode',
+        'encode',
+    }) do
+        assert.equal(stats[kind], {
+            calls = 0,
+            allocs = 0,
+            reallocs = 0,
+            bytes = 0,
+            peak = 0,
+            yyjson_time = 0,
+            lua_time = 0,
+            last = {
+                calls = 0,
+                allocs = 0,
+                reallocs = 0,
+                bytes = 0,
+                peak = 0,
+                yyjson_time = 0,
+                lua_time = 0,
+            },
+        })
+    end
+
+    -- test that the decode calls are recorded
+    assert(yyjson.decode('{"foo":[1,2,3],"bar":"baz"}'))
+    assert(yyjson.decode('[1,2,3]'))
+    stats = yyjson.stats()
+    assert.equal(stats.decode.calls, 2)
+    assert.equal(stats.decode.last.calls, 1)
+    assert.greater(stats.decode.allocs, stats.decode.last.allocs - 1)
+    assert.greater(stats.decode.last.allocs, 0)
+    assert.greater(stats.decode.last.bytes, 0)
+    assert.greater(stats.decode.last.peak, 0)
+    assert.greater(stats.decode.peak, stats.decode.last.peak - 1)
+    assert.equal(stats.encode.calls, 0)
+    -- the elapsed times are not measured by default
+    assert.equal(stats.decode.yyjson_time, 0)
+    assert.equal(stats.decode.lua_time, 0)
+
+    -- test that the elapsed times are measured if the timing is enabled
+    yyjson.stats(true, true)
+    local s = assert(yyjson.encode({
+        list = {
+            string.rep('foo', 1000),
+        },
+    }))
+    for _ = 1, 100 do
+        assert(yyjson.decode(s))
+    end
+    stats = yyjson.stats(true, false)
+    assert.greater(stats.decode.yyjson_time + stats.decode.lua_time, 0)
+    assert.greater(stats.encode.lua_time, -1)
+    assert(yyjson.decode(s))
+    stats = yyjson.stats(true)
+    assert.equal(stats.decode.calls, 1)
+    assert.equal(stats.decode.lua_time, 0)
+
+    -- test that the encode calls are recorded
+    assert(yyjson.encode({
+        foo = 'bar',
+    }))
+    assert(yyjson.encode({
+        foo = 'bar',
+    }, {
+        direct = true,
+    }))
+    stats = yyjson.stats(true)
+    assert.equal(stats.encode.calls, 2)
+    assert.greater(stats.encode.allocs, 0)
+    -- the direct mode does not use the writer of yyjson
+    assert.equal(stats.encode.last.yyjson_time, 0)
+
+    -- test that the statistics are cleared after returning them
+    stats = yyjson.stats()
+    assert.equal(stats.decode.calls, 0)
+    assert.equal(stats.encode.calls, 0)
+
+    -- test that the other decode and encode calls are recorded
+    local pathname = os.tmpname()
+    local enc = yyjson.compile_encoder({
+        {
+            'foo',
+            'string',
+        },
+    })
+    assert(yyjson.encode_file({
+        foo = 'bar',
+    }, pathname))
+    assert(yyjson.encode_many({
+        1,
+        2,
+    }))
+    assert(enc:encode({
+        foo = 'bar',
+    }))
+    assert(yyjson.decode_file(pathname))
+    assert(yyjson.decode_many({
+        '1',
+        '2',
+    }))
+    assert(yyjson.get('{"foo":1}', '/foo'))
+    stats = yyjson.stats(true)
+    os.remove(pathname)
+    assert.equal(stats.encode.calls, 3)
+    -- each string of decode_many is counted as a call
+    assert.equal(stats.decode.calls, 4)
+
+    -- test that the iterator is not recorded
+    local n = 0
+    for _ in yyjson.decode_iter('1 2') do
+        n = n + 1
+    end
+    assert.equal(n, 2)
+    stats = yyjson.stats()
+    assert.equal(stats.decode.calls, 0)
+end
+
 function testcase.decode_empty_content()
     -- test that decode empty content
     local s = table.concat({
@@ -258,3 +380,2463 @@ function testcase.memory_limit_decode()
     assert.match(err, 'memory')
     assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
 end
+
+function testcase.arena()
+    local arena = assert(yyjson.arena(64))
+    assert.match(tostring(arena), '^yyjson.arena: ')
+    assert.equal(#arena, 64)
+
+    -- test that the arena can be reused across decode and encode calls
+    local exp = {
+        foo = 'bar',
+        baz = {
+            true,
+            false,
+            1,
+            1.05,
+            'hello',
+        },
+    }
+    local s = assert(yyjson.encode(exp, arena))
+    for _ = 1, 3 do
+        local act = assert(yyjson.decode(s, nil, nil, arena))
+        assert.equal(act, exp)
+        assert.equal(assert(yyjson.encode(act, arena)), s)
+    end
+
+    -- test that the buffer is grown to the peak usage of the call
+    assert.greater(#arena, 64)
+
+    -- test that limit memory usage
+    arena = assert(yyjson.arena(0, 100))
+    local v, err, errno = yyjson.decode(s, nil, nil, arena)
+    assert.is_nil(v)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
+
+    -- test that the arena can be reused after the invalid option error
+    arena = assert(yyjson.arena(64))
+    local pathname = os.tmpname()
+    local enc = yyjson.compile_encoder({
+        {
+            'foo',
+            'string',
+        },
+    })
+    assert(yyjson.encode_file(exp, pathname))
+    for _, call in ipairs({
+        function()
+            return yyjson.decode(s, nil, nil, {
+                arena = arena,
+                keep = 'foo',
+            })
+        end,
+        function()
+            return yyjson.decode_file(pathname, nil, nil, {
+                arena = arena,
+                max_depth = 'foo',
+            })
+        end,
+        function()
+            return yyjson.encode(exp, {
+                arena = arena,
+                table_mode = 'foo',
+            })
+        end,
+        function()
+            return yyjson.encode(exp, {
+                arena = arena,
+                direct = 'foo',
+            })
+        end,
+        function()
+            return yyjson.encode_many({
+                exp,
+            }, {
+                arena = arena,
+                empty_table = 'foo',
+            })
+        end,
+        function()
+            return yyjson.encode_file(exp, pathname, {
+                arena = arena,
+                max_depth = 'foo',
+            })
+        end,
+        function()
+            return enc:encode({
+                foo = 'bar',
+            }, {
+                arena = arena,
+                table_mode = 'foo',
+            })
+        end,
+    }) do
+        assert.throws(call)
+        assert.equal(assert(yyjson.decode(s, nil, nil, arena)), exp)
+    end
+    os.remove(pathname)
+
+    -- test that the arena can be reused after the error that is raised while
+    -- pushing the values. the finalizer error is propagated to the allocation
+    -- of the pushed table by Lua 5.1-5.3 and LuaJIT, while Lua 5.4 only warns.
+    local list = {}
+    for i = 1, 20000 do
+        list[i] = {
+            i,
+        }
+    end
+    local large = assert(yyjson.encode(list))
+    list = nil
+    collectgarbage('collect')
+    if newproxy then
+        getmetatable(newproxy(true)).__gc = function()
+            error('finalizer error')
+        end
+    else
+        setmetatable({}, {
+            __gc = function()
+                error('finalizer error')
+            end,
+        })
+    end
+    pcall(yyjson.decode, large, nil, nil, arena)
+    assert.equal(assert(yyjson.decode(s, nil, nil, arena)), exp)
+end
+
+function testcase.parse()
+    local s = '{"foo":"bar","qux":[1,null,"hello",{"baz":true}],"nil":null}'
+
+    -- test that the input shorter than the padding size is not read
+    do
+        local v, err, errno = yyjson.parse('1', nil, nil, nil,
+                                           yyjson.READ_INSITU)
+        assert.is_nil(v)
+        assert.is_string(err)
+        assert.equal(type(errno), 'number')
+    end
+
+    -- test that the raw_number option is applied to the values of the view
+    do
+        local v = assert(yyjson.parse('[12345678901234567890123]', nil, nil, {
+            raw_number = 'string',
+        }, yyjson.READ_NUMBER_AS_RAW))
+        assert.equal(v[1], '12345678901234567890123')
+
+        -- test that throws an error if keep or drop option is specified
+        local err = assert.throws(yyjson.parse, '[1]', nil, nil, {
+            keep = {
+                'foo',
+            },
+        })
+        assert.match(err, 'keep and drop cannot be used for the view')
+    end
+
+    -- test that returns a view of the document
+    local v, err, errno, len = yyjson.parse(s)
+    assert.match(tostring(v), '^yyjson.view: ')
+    assert.is_nil(err)
+    assert.is_nil(errno)
+    assert.equal(len, #s)
+    assert.equal(#v, 3)
+    assert.equal(v.foo, 'bar')
+    assert.is_nil(v.unknown)
+    assert.is_nil(v['nil'])
+
+    -- test that container values are resolved as views on demand
+    local qux = v.qux
+    assert.match(tostring(qux), '^yyjson.view: ')
+    assert.equal(#qux, 4)
+    assert.equal(qux[1], 1)
+    assert.is_nil(qux[2])
+    assert.equal(qux[3], 'hello')
+    assert.is_nil(qux[5])
+    assert.is_nil(qux.foo)
+    assert.equal(qux[4].baz, true)
+
+    -- test that iterate over the members
+    local act = {}
+    for k, val in yyjson.pairs(qux) do
+        act[k] = val
+    end
+    assert.equal(act[1], 1)
+    assert.equal(act[3], 'hello')
+    assert.equal(act[4](), {
+        baz = true,
+    })
+    act = {}
+    for k, val in yyjson.pairs(v) do
+        act[k] = type(val)
+    end
+    assert.equal(act, {
+        foo = 'string',
+        qux = 'userdata',
+    })
+
+    -- test that materialize the view
+    assert.equal(v(), yyjson.decode(s))
+
+    -- test that the child view outlives the root view
+    v = nil
+    collectgarbage()
+    collectgarbage()
+    assert.equal(qux(), {
+        1,
+        nil,
+        'hello',
+        {
+            baz = true,
+        },
+    })
+
+    -- test that decode null value to yyjson.NULL
+    v = assert(yyjson.parse(s, true))
+    assert.equal(v['nil'], yyjson.NULL)
+
+    -- test that scalar value is returned as a Lua value
+    assert.equal(yyjson.parse('"hello"'), 'hello')
+
+    -- test that returns an error
+    v, err, errno = yyjson.parse('{"foo":')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+end
+
+function testcase.get()
+    local s = '{"meta":{"trace_id":"abc"},"items":[{"price":1.5},{"price":2}]}'
+
+    -- test that returns the value of the pointer
+    assert.equal(yyjson.get(s, '/meta/trace_id'), 'abc')
+    assert.equal(yyjson.get(s, '/items/1/price'), 2)
+    assert.equal(yyjson.get(s, '/items/0'), {
+        price = 1.5,
+    })
+    assert.equal(yyjson.get(s, '/items', nil, true), {
+        [-1] = yyjson.AS_ARRAY,
+        {
+            [-1] = yyjson.AS_OBJECT,
+            price = 1.5,
+        },
+        {
+            [-1] = yyjson.AS_OBJECT,
+            price = 2,
+        },
+    })
+
+    -- test that returns an error if the pointer cannot be resolved
+    local v, err, errno = yyjson.get(s, '/items/2/price')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.PTR_ERR_RESOLVE)
+
+    v, err, errno = yyjson.get(s, 'meta')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.PTR_ERR_SYNTAX)
+
+    -- test that returns the values of the multiple pointers
+    v = assert(yyjson.get(s, {
+        '/meta/trace_id',
+        '/unknown',
+        '/items/0/price',
+    }))
+    assert.equal(v, {
+        [1] = 'abc',
+        [3] = 1.5,
+    })
+
+    -- test that throws an error if the pointers contains non-string value
+    err = assert.throws(yyjson.get, s, {
+        '/meta',
+        1,
+    })
+    assert.match(err, 'array of strings expected')
+
+    -- test that returns an error if the JSON is invalid
+    v, err, errno = yyjson.get('{"foo":', '/foo')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+
+    -- test that the Lua string is never modified by READ_INSITU flag
+    s = '{"foo":"b\\u0061r"}' .. string.rep(string.char(0),
+                                             yyjson.PADDING_SIZE)
+    for _ = 1, 2 do
+        v = assert(yyjson.get(s, '/foo', nil, nil, nil, yyjson.READ_INSITU))
+        assert.equal(v, 'bar')
+        -- the escape sequence is still in the string
+        assert.equal(s:sub(9, 16), 'b\\u0061r')
+    end
+
+    -- test that the decode options are applied to the pointed value
+    s = '{"items":[{"id":1,"name":"foo"},{"id":2,"name":"bar"}],"n":[[1]]}'
+    assert.equal(yyjson.get(s, '/items', nil, nil, {
+        keep = {
+            '/*/id',
+        },
+        key_cache = true,
+    }), {
+        {
+            id = 1,
+        },
+        {
+            id = 2,
+        },
+    })
+    assert.equal(yyjson.get(s, {
+        '/items/0',
+        '/items/1',
+    }, nil, nil, {
+        drop = {
+            'name',
+        },
+    }), {
+        {
+            id = 1,
+        },
+        {
+            id = 2,
+        },
+    })
+    v, err = yyjson.get(s, '/n', nil, nil, {
+        max_depth = 1,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'maximum depth')
+    assert.equal(yyjson.get(s, '/items/0/id', nil, nil, {
+        raw_number = 'string',
+    }, yyjson.READ_NUMBER_AS_RAW), '1')
+
+    -- test that the input shorter than the padding size is not read
+    v, err, errno = yyjson.get('1', '', nil, nil, nil, yyjson.READ_INSITU)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(type(errno), 'number')
+end
+
+function testcase.decode_iter()
+    local ndjson = {
+        '[true,false,1,1.05,null,"hello"]',
+        '\n{"foo":"bar"}',
+        '\nnull\n',
+    }
+    local exp = {
+        {
+            true,
+            false,
+            1,
+            1.05,
+            nil,
+            'hello',
+        },
+        {
+            foo = 'bar',
+        },
+    }
+
+    -- test that iterate over the NDJSON values
+    local s = table.concat(ndjson)
+    local i = 0
+    local pos = 0
+    for p, v in yyjson.decode_iter(s) do
+        i = i + 1
+        pos = pos + #ndjson[i]
+        assert.equal(v, exp[i])
+        if i < 3 then
+            assert.equal(p, pos)
+        end
+    end
+    assert.equal(i, 3)
+
+    -- test that iterate with the arena
+    i = 0
+    local arena = assert(yyjson.arena())
+    for _, v in yyjson.decode_iter(s, true, nil, arena) do
+        i = i + 1
+        if i == 3 then
+            assert.equal(v, yyjson.NULL)
+        end
+    end
+    assert.equal(i, 3)
+
+    -- test that returns false and an error
+    i = 0
+    local iter = yyjson.decode_iter('[1][2')
+    for p, v, err, errno in iter do
+        i = i + 1
+        if i == 1 then
+            assert.equal(p, 3)
+            assert.equal(v, {
+                1,
+            })
+        else
+            assert.is_false(p)
+            assert.is_nil(v)
+            assert.is_string(err)
+            assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+            break
+        end
+    end
+    assert.equal(i, 2)
+    -- test that stop the iteration after an error
+    assert.is_nil(iter())
+end
+
+function testcase.decode_file()
+    local exp = {
+        foo = 'bar',
+        baz = {
+            true,
+            false,
+            1,
+            1.05,
+            'hello',
+        },
+    }
+    local s = assert(yyjson.encode(exp))
+    local pathname = os.tmpname()
+    local f = assert(io.open(pathname, 'w'))
+    f:write(s)
+    f:close()
+
+    -- test that decode the file
+    local act, err, errno, len = yyjson.decode_file(pathname)
+    assert.equal(act, exp)
+    assert.is_nil(err)
+    assert.is_nil(errno)
+    assert.equal(len, #s)
+
+    -- test that decode the memory-mapped file in-situ
+    act = assert(yyjson.decode_file(pathname, nil, nil, nil, yyjson.READ_INSITU))
+    assert.equal(act, exp)
+
+    -- test that decode the file handle
+    f = assert(io.open(pathname))
+    act = assert(yyjson.decode_file(f))
+    f:close()
+    assert.equal(act, exp)
+
+    -- test that throws an error if the file handle is closed
+    err = assert.throws(yyjson.decode_file, f)
+    assert.match(err, 'closed file')
+
+    -- test that returns an error if the file does not exist
+    os.remove(pathname)
+    act, err, errno = yyjson.decode_file(pathname)
+    assert.is_nil(act)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_FILE_OPEN)
+
+    act, err, errno = yyjson.decode_file(pathname, nil, nil, nil,
+                                         yyjson.READ_INSITU)
+    assert.is_nil(act)
+    assert.match(err, pathname, false)
+    assert.equal(errno, yyjson.READ_ERROR_FILE_OPEN)
+end
+
+function testcase.encode_file()
+    local v = {
+        foo = 'bar',
+        baz = {
+            true,
+            false,
+            1,
+            1.05,
+            'hello',
+        },
+    }
+    local exp = assert(yyjson.encode(v))
+    local pathname = os.tmpname()
+
+    -- test that encode a value to the file
+    assert.is_true(yyjson.encode_file(v, pathname))
+    local f = assert(io.open(pathname))
+    assert.equal(f:read('*a'), exp)
+    f:close()
+
+    -- test that encode a value to the file handle
+    f = assert(io.open(pathname, 'w+'))
+    assert.is_true(yyjson.encode_file(v, f, nil, yyjson.WRITE_PRETTY))
+    f:seek('set')
+    exp = assert(yyjson.encode(v, nil, yyjson.WRITE_PRETTY))
+    assert.equal(f:read('*a'), exp)
+    f:close()
+    os.remove(pathname)
+
+    -- test that encode a value to the sink function
+    local chunks = {}
+    assert.is_true(yyjson.encode_file(v, function(chunk)
+        chunks[#chunks + 1] = chunk
+    end))
+    assert.equal(table.concat(chunks), assert(yyjson.encode(v)))
+
+    -- test that the large output is passed by chunks
+    local list = {}
+    for i = 1, 20000 do
+        list[i] = 'hello world'
+    end
+    chunks = {}
+    assert.is_true(yyjson.encode_file(list, function(chunk)
+        chunks[#chunks + 1] = chunk
+        return true
+    end))
+    assert.greater(#chunks, 1)
+    assert.equal(table.concat(chunks), assert(yyjson.encode(list)))
+    for _, chunk in ipairs(chunks) do
+        assert.less_or_equal(#chunk, 65536)
+    end
+
+    -- test that the encoding is aborted at the first chunk
+    local ncall = 0
+    local ok, err, errno = yyjson.encode_file(list, function()
+        ncall = ncall + 1
+        return false
+    end)
+    assert.is_nil(ok)
+    assert.equal(err, 'sink function returned false')
+    assert.equal(errno, yyjson.WRITE_ERROR_FILE_WRITE)
+    assert.equal(ncall, 1)
+
+    -- test that returns an error if the sink function returns an error
+    ok, err, errno = yyjson.encode_file(v, function()
+        return nil, 'sink error'
+    end)
+    assert.is_nil(ok)
+    assert.equal(err, 'sink error')
+    assert.equal(errno, yyjson.WRITE_ERROR_FILE_WRITE)
+
+    -- test that rethrows the error of the sink function
+    err = assert.throws(yyjson.encode_file, v, function()
+        error('sink raised')
+    end)
+    assert.match(err, 'sink raised')
+
+    -- test that returns an error if the file cannot be opened
+    ok, err, errno = yyjson.encode_file(v, '/non/existent/file')
+    assert.is_nil(ok)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.WRITE_ERROR_FILE_OPEN)
+end
+
+function testcase.buffer()
+    local buf = assert(yyjson.buffer(16))
+    assert.match(tostring(buf), '^yyjson.buffer: ')
+    assert.equal(#buf, 0)
+    assert.greater_or_equal(buf:reserve(0), 16)
+
+    -- test that append the strings
+    assert.equal(buf:write('{"foo":', '"bar\\n"}'), buf)
+    assert.equal(#buf, 16)
+    assert.equal(buf:tostring(), '{"foo":"bar\\n"}')
+
+    -- test that decode the buffer in-situ and consume the decoded bytes
+    buf:write(' [1,2,3]')
+    local v, err, errno, len = yyjson.decode(buf, nil, nil, nil,
+                                             yyjson.READ_STOP_WHEN_DONE)
+    assert.equal(v, {
+        foo = 'bar\n',
+    })
+    assert.is_nil(err)
+    assert.is_nil(errno)
+    assert.equal(len, 16)
+    assert.equal(buf:tostring(), ' [1,2,3]')
+    v = assert(yyjson.decode(buf))
+    assert.equal(v, {
+        1,
+        2,
+        3,
+    })
+    assert.equal(#buf, 0)
+
+    -- test that the partial document is kept with READ_STOP_WHEN_DONE flag
+    buf:write('{"foo":"b\\u0061r", "baz": [')
+    local partial = buf:tostring()
+    v, err, errno = yyjson.decode(buf, nil, nil, nil,
+                                  yyjson.READ_STOP_WHEN_DONE)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+    assert.equal(buf:tostring(), partial)
+    buf:write('1]}')
+    v = assert(yyjson.decode(buf, nil, nil, nil, yyjson.READ_STOP_WHEN_DONE))
+    assert.equal(v, {
+        foo = 'bar',
+        baz = {
+            1,
+        },
+    })
+    assert.equal(#buf, 0)
+
+    -- test that the content is discarded after the in-situ parse failed
+    buf:write('{"foo":"b\\u0061r", "baz": [')
+    v, err, errno = yyjson.decode(buf)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+    assert.equal(#buf, 0)
+    assert.equal(buf:tostring(), '')
+    -- the rest of the discarded document is not a valid document
+    buf:write('1]}')
+    v, err = yyjson.decode(buf)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(#buf, 0)
+    buf:write('{"foo":"bar"}')
+    assert.equal(yyjson.decode(buf), {
+        foo = 'bar',
+    })
+
+    -- test that reuse the buffer after reset
+    buf:write('foo')
+    buf:reset()
+    assert.equal(#buf, 0)
+    buf:write('"hello"')
+    assert.equal(yyjson.decode(buf), 'hello')
+
+    -- test that returns an error for an empty buffer
+    v, err, errno = yyjson.decode(buf)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_EMPTY_CONTENT)
+
+    -- test that throws an error if the argument is not a string
+    err = assert.throws(buf.write, buf, {})
+    assert.match(err, 'string expected')
+end
+
+function testcase.decode_embedded_nul()
+    -- test that decode the strings and keys that contain NUL characters
+    local act = assert(yyjson.decode('{"foo\\u0000bar":["baz\\u0000qux"]}'))
+    assert.equal(act, {
+        ['foo\0bar'] = {
+            'baz\0qux',
+        },
+    })
+end
+
+function testcase.decode_options()
+    local s = yyjson.encode({
+        {
+            id = 1,
+            name = 'foo',
+            tags = {
+                'a',
+            },
+        },
+        {
+            id = 2,
+            name = 'bar',
+            tags = {
+                'b',
+            },
+        },
+        {
+            id = 3,
+            name = 'baz',
+            [string.rep('k', 100)] = true,
+        },
+    })
+
+    -- test that decode with the key cache
+    local exp = assert(yyjson.decode(s))
+    local act = assert(yyjson.decode(s, nil, nil, {
+        key_cache = true,
+    }))
+    assert.equal(act, exp)
+
+    -- test that decode with the mlimit option
+    local v, err, errno = yyjson.decode(s, nil, nil, {
+        mlimit = 1,
+        key_cache = true,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
+
+    -- test that decode with the arena option
+    local arena = assert(yyjson.arena())
+    act = assert(yyjson.decode(s, nil, nil, {
+        arena = arena,
+        key_cache = true,
+    }))
+    assert.equal(act, exp)
+    assert.greater(#arena, 0)
+
+    -- test that the key cache is shared across the values of decode_iter
+    local n = 0
+    for pos, val, e in yyjson.decode_iter(s .. '\n' .. s, nil, nil, {
+        key_cache = true,
+    }) do
+        assert(pos, e)
+        assert.equal(val, exp)
+        n = n + 1
+    end
+    assert.equal(n, 2)
+
+    -- test that decode_file with the key cache
+    local filename = os.tmpname()
+    local f = assert(io.open(filename, 'w'))
+    f:write(s)
+    f:close()
+    act = assert(yyjson.decode_file(filename, nil, nil, {
+        key_cache = true,
+    }))
+    os.remove(filename)
+    assert.equal(act, exp)
+
+    -- test that decode the deeply nested values
+    local deep = string.rep('[{"a":', 100) .. '1' .. string.rep('}]', 100)
+    act = assert(yyjson.decode(deep))
+    for _ = 1, 100 do
+        assert.equal(#act, 1)
+        act = act[1].a
+    end
+    assert.equal(act, 1)
+
+    -- test that the grown frame stack is not left in the results
+    local nres, res, reserr, reserrno, reslen =
+        select('#', yyjson.decode(deep)), yyjson.decode(deep)
+    assert.equal(nres, 4)
+    assert.is_table(res)
+    assert.is_nil(reserr)
+    assert.is_nil(reserrno)
+    assert.equal(reslen, #deep)
+
+    -- test that decode with the max_depth option
+    act = assert(yyjson.decode(deep, nil, nil, {
+        max_depth = 200,
+    }))
+    assert.is_table(act)
+    v, err = yyjson.decode(deep, nil, nil, {
+        max_depth = 199,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'exceeded the maximum depth')
+    assert.equal(yyjson.decode('1', nil, nil, {
+        max_depth = 1,
+    }), 1)
+    assert.equal(yyjson.decode('[1]', nil, nil, {
+        max_depth = 1,
+    }), {
+        1,
+    })
+    v, err = yyjson.decode('[[1]]', nil, nil, {
+        max_depth = 1,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'exceeded the maximum depth')
+
+    -- test that throws an error if the option is invalid
+    err = assert.throws(yyjson.decode, s, nil, nil, {
+        max_depth = true,
+    })
+    assert.match(err, 'max_depth must be number')
+    err = assert.throws(yyjson.decode, s, nil, nil, {
+        key_cache = 1,
+    })
+    assert.match(err, 'key_cache must be boolean')
+    err = assert.throws(yyjson.decode, s, nil, nil, {
+        arena = {},
+    })
+    assert.match(err, 'arena must be yyjson.arena')
+end
+
+function testcase.decode_raw_number()
+    local s = '{"id":12345678901234567890123,"amount":0.1000000000000000055511}'
+
+    -- test that the raw numbers are decoded as yyjson.raw values
+    local v = assert(yyjson.decode(s, nil, nil, nil, yyjson.READ_NUMBER_AS_RAW))
+    assert.match(tostring(v.id), '^yyjson.raw: ')
+    assert.equal(#v.id, #'12345678901234567890123')
+    assert.equal(#v.amount, #'0.1000000000000000055511')
+
+    -- test that the raw values are encoded back without precision loss
+    for _, direct in ipairs({
+        false,
+        true,
+    }) do
+        local res = assert(yyjson.encode({
+            [-1] = yyjson.AS_ARRAY,
+            v.id,
+            v.amount,
+        }, {
+            direct = direct,
+        }))
+        assert.equal(res, '[12345678901234567890123,0.1000000000000000055511]')
+    end
+
+    -- test that the big numbers only are decoded as raw values
+    v = assert(yyjson.decode('[1,18446744073709551616]', nil, nil, nil,
+                             yyjson.READ_BIGNUM_AS_RAW))
+    assert.equal(v[1], 1)
+    assert.equal(yyjson.encode(v), '[1,18446744073709551616]')
+
+    -- test that the raw numbers are decoded as strings
+    v = assert(yyjson.decode(s, nil, nil, {
+        raw_number = 'string',
+    }, yyjson.READ_NUMBER_AS_RAW))
+    assert.equal(v, {
+        id = '12345678901234567890123',
+        amount = '0.1000000000000000055511',
+    })
+
+    -- test that the unsigned integer beyond the range of lua_Integer is
+    -- decoded as a float instead of wrapping around
+    v = assert(yyjson.decode('[18446744073709551615]'))
+    assert.greater(v[1], 0)
+    assert.equal(v[1], 18446744073709551615.0)
+
+    -- test that the unsigned integer beyond the range of lua_Integer is
+    -- decoded as a raw number if the raw_number option is specified
+    v = assert(yyjson.decode('[18446744073709551615,1]', nil, nil, {
+        raw_number = 'string',
+    }))
+    assert.equal(v, {
+        '18446744073709551615',
+        1,
+    })
+    v = assert(yyjson.decode('[18446744073709551615]', nil, nil, {
+        raw_number = 'raw',
+    }))
+    assert.match(tostring(v[1]), '^yyjson.raw: ')
+    assert.equal(yyjson.encode(v), '[18446744073709551615]')
+
+    -- test that throws an error if the raw_number option is invalid
+    local err = assert.throws(yyjson.decode, s, nil, nil, {
+        raw_number = 'foo',
+    })
+    assert.match(err, "raw_number must be 'raw' or 'string'")
+end
+
+function testcase.decode_projection()
+    local s = yyjson.encode({
+        id = 1,
+        user = {
+            name = 'foo',
+            age = 20,
+            ['a/b'] = true,
+        },
+        items = {
+            {
+                id = 'x',
+                price = 10,
+            },
+            {
+                id = 'y',
+                price = 20,
+            },
+        },
+        debug = {
+            trace = {
+                1,
+                2,
+                3,
+            },
+        },
+    })
+
+    -- test that keep the values of the paths
+    assert.equal(yyjson.decode(s, nil, nil, {
+        keep = {
+            'id',
+            '/user/name',
+            '/user/a~1b',
+            '/items/*/id',
+            '/debug/trace/1',
+            '/id/unknown',
+        },
+    }), {
+        id = 1,
+        user = {
+            name = 'foo',
+            ['a/b'] = true,
+        },
+        items = {
+            {
+                id = 'x',
+            },
+            {
+                id = 'y',
+            },
+        },
+        debug = {
+            trace = {
+                [2] = 2,
+            },
+        },
+    })
+
+    -- test that the scalar value is not kept if the path goes through it
+    assert.equal(yyjson.decode(s, nil, nil, {
+        keep = {
+            '/user/name/first',
+        },
+    }), {
+        user = {},
+    })
+
+    -- test that drop the values of the paths
+    assert.equal(yyjson.decode(s, nil, nil, {
+        drop = {
+            'debug',
+            '/items/*/price',
+            '/items/0',
+            '/user/age',
+        },
+    }), {
+        id = 1,
+        user = {
+            name = 'foo',
+            ['a/b'] = true,
+        },
+        items = {
+            [2] = {
+                id = 'y',
+            },
+        },
+    })
+
+    -- test that the empty path refers to the whole document
+    assert.equal(yyjson.decode(s, nil, nil, {
+        keep = {
+            '',
+        },
+    }), yyjson.decode(s))
+    assert.is_nil(yyjson.decode(s, nil, nil, {
+        drop = {
+            '',
+        },
+    }))
+
+    -- test that the projection is applied to each value
+    local n = 0
+    for _, v in yyjson.decode_iter(s .. s, nil, nil, {
+        keep = {
+            'id',
+        },
+    }) do
+        assert.equal(v, {
+            id = 1,
+        })
+        n = n + 1
+    end
+    assert.equal(n, 2)
+    assert.equal(yyjson.decode_many({
+        s,
+    }, nil, nil, {
+        drop = {
+            'items',
+            'user',
+            'debug',
+        },
+    }), {
+        {
+            id = 1,
+        },
+    })
+    local dec = yyjson.decoder(nil, nil, {
+        ndjson = true,
+        keep = {
+            'id',
+        },
+    })
+    assert.equal(dec:feed(s .. '\n'), {
+        {
+            id = 1,
+        },
+    })
+
+    -- test that throws an error if the option is invalid
+    local err = assert.throws(yyjson.decode, s, nil, nil, {
+        keep = {
+            'id',
+        },
+        drop = {
+            'id',
+        },
+    })
+    assert.match(err, 'keep and drop cannot be used together')
+    err = assert.throws(yyjson.decode, s, nil, nil, {
+        keep = 'id',
+    })
+    assert.match(err, 'keep must be table')
+    err = assert.throws(yyjson.decode, s, nil, nil, {
+        drop = {
+            1,
+        },
+    })
+    assert.match(err, 'drop #1 must be string')
+end
+
+function testcase.encode_sparse_array()
+    -- test that encode the elements in the hash part in order
+    local t = {}
+    for i = 5, 1, -1 do
+        t[i] = i
+    end
+    t[10] = 10
+    t[8] = 8
+    assert.equal(yyjson.encode(t), '[1,2,3,4,5,null,null,8,null,10]')
+
+    -- test that encode the array that has the holes in the sequence part
+    t = {
+        1,
+        nil,
+        3,
+    }
+    assert.equal(yyjson.encode(t), '[1,null,3]')
+
+    -- test that the values that cannot be encoded are skipped
+    t = {
+        1,
+        print,
+        3,
+        print,
+    }
+    assert.equal(yyjson.encode(t), '[1,null,3]')
+
+    -- test that the non-positive and string keys are ignored
+    t = {
+        1,
+        [0] = 0,
+        [-2] = -2,
+        foo = 'bar',
+        [3] = 3,
+    }
+    assert.equal(yyjson.encode(t), '[1,null,3]')
+
+    -- test that encode the large array that is built in reverse order
+    t = {}
+    for i = 10000, 1, -1 do
+        t[i] = i
+    end
+    local s = assert(yyjson.encode(t))
+    assert.equal(yyjson.decode(s), t)
+
+    -- test that the sequence part and the hash part are merged in order
+    t = {
+        1,
+        2,
+        nil,
+        4,
+    }
+    t[7] = 7
+    t[3] = 3
+    t[6] = 6
+    for _, opts in ipairs({
+        {},
+        {
+            direct = true,
+        },
+    }) do
+        assert.equal(yyjson.encode(t, opts), '[1,2,3,4,null,6,7]')
+    end
+end
+
+function testcase.encode_table_options()
+    -- test that the empty table is encoded as an object by default
+    assert.equal(yyjson.encode({}), '{}')
+    assert.equal(yyjson.encode({}, {
+        empty_table = 'object',
+    }), '{}')
+
+    -- test that the empty table is encoded as an array
+    for _, direct in ipairs({
+        false,
+        true,
+    }) do
+        local s = assert(yyjson.encode({
+            list = {},
+            obj = yyjson.as_object({}),
+            nested = {
+                {},
+            },
+            hash = {
+                foo = 'bar',
+            },
+        }, {
+            empty_table = 'array',
+            direct = direct,
+        }))
+        assert.equal(yyjson.decode(s), {
+            list = {},
+            obj = {},
+            nested = {
+                {},
+            },
+            hash = {
+                foo = 'bar',
+            },
+        })
+        assert(s:find('"list":[]', 1, true))
+        assert(s:find('"obj":{}', 1, true))
+        assert(s:find('"nested":[[]]', 1, true))
+    end
+
+    -- test that the rawlen mode ignores the elements in the hash part
+    local t = {
+        1,
+        2,
+        3,
+    }
+    t[10] = 10
+    assert.equal(yyjson.encode(t), '[1,2,3,null,null,null,null,null,null,10]')
+    for _, direct in ipairs({
+        false,
+        true,
+    }) do
+        assert.equal(yyjson.encode(t, {
+            table_mode = 'rawlen',
+            direct = direct,
+        }), '[1,2,3]')
+    end
+
+    -- test that the strict mode accepts the tables that are fully encoded
+    t = {
+        list = {
+            1,
+            'foo',
+            yyjson.NULL,
+        },
+        obj = {
+            [-1] = yyjson.AS_OBJECT,
+            foo = 'bar',
+        },
+        arr = {
+            [-1] = yyjson.AS_ARRAY,
+        },
+    }
+    for _, direct in ipairs({
+        false,
+        true,
+    }) do
+        local s = assert(yyjson.encode(t, {
+            table_mode = 'strict',
+            direct = direct,
+        }))
+        assert.equal(yyjson.decode(s), {
+            list = {
+                1,
+                'foo',
+            },
+            obj = {
+                foo = 'bar',
+            },
+            arr = {},
+        })
+    end
+
+    -- test that the strict mode fails on the keys and values that are not
+    -- encoded
+    for _, v in ipairs({
+        {
+            val = {
+                1,
+                foo = 'bar',
+            },
+            err = 'not a positive integer',
+        },
+        {
+            val = {
+                foo = 'bar',
+                [true] = 'baz',
+            },
+            err = 'non-string key',
+        },
+        {
+            val = {
+                {
+                    foo = print,
+                },
+            },
+            err = 'unsupported value type',
+        },
+    }) do
+        for _, direct in ipairs({
+            false,
+            true,
+        }) do
+            local s, err, errno = yyjson.encode(v.val, {
+                table_mode = 'strict',
+                direct = direct,
+            })
+            assert.is_nil(s)
+            assert.match(err, v.err)
+            assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+        end
+    end
+
+    -- test that throws an error if the option value is invalid
+    local err = assert.throws(yyjson.encode, {}, {
+        empty_table = 'foo',
+    })
+    assert.match(err, "empty_table must be 'object' or 'array'")
+    err = assert.throws(yyjson.encode, {}, {
+        table_mode = 1,
+    })
+    assert.match(err, 'table_mode must be string')
+end
+
+function testcase.as_array_as_object()
+    -- test that the tables tagged by the metatable are encoded as that type
+    local t = yyjson.as_array({
+        hello = 'world',
+    })
+    assert.equal(t.hello, 'world')
+    assert.equal(yyjson.encode(t), '[]')
+    t = yyjson.as_object({
+        'foo',
+        hello = 'world',
+    })
+    assert.equal(yyjson.encode(t), '{"hello":"world"}')
+    assert.equal(yyjson.encode({
+        yyjson.as_array({}),
+        yyjson.as_object({}),
+    }), '[[],{}]')
+
+    -- test that the metatables are shared by all tagged tables
+    assert.equal(getmetatable(yyjson.as_array({})),
+                 getmetatable(yyjson.as_array({})))
+
+    -- test that the __jsontype field of the user metatable is used
+    local mt = {
+        __jsontype = 'array',
+    }
+    assert.equal(yyjson.encode(setmetatable({}, mt)), '[]')
+    assert.equal(yyjson.encode({
+        setmetatable({}, mt),
+        setmetatable({}, mt),
+    }), '[[],[]]')
+    mt = {
+        __jsontype = 'object',
+    }
+    assert.equal(yyjson.encode(setmetatable({
+        'foo',
+    }, mt)), '{}')
+
+    -- test that the metatable takes precedence over the -1st element
+    assert.equal(yyjson.encode(yyjson.as_array({
+        [-1] = yyjson.AS_OBJECT,
+    })), '[]')
+
+    -- test that the unknown __jsontype falls back to the default handling
+    mt = {
+        __jsontype = 'unknown',
+    }
+    assert.equal(yyjson.encode(setmetatable({
+        'foo',
+    }, mt)), '["foo"]')
+
+    -- test that the writer handles the tagged tables
+    local w = yyjson.writer()
+    assert.equal(w:encode(yyjson.as_array({})), '[]')
+
+    -- test that the tagged table can be tagged again
+    t = yyjson.as_object(yyjson.as_array({}))
+    assert.equal(yyjson.encode(t), '{}')
+
+    -- test that the markers option skips the -1st element
+    t = {
+        [-1] = yyjson.AS_ARRAY,
+    }
+    for _, direct in ipairs({
+        false,
+        true,
+    }) do
+        assert.equal(yyjson.encode(t, {
+            direct = direct,
+        }), '[]')
+        assert.equal(yyjson.encode(t, {
+            direct = direct,
+            markers = false,
+        }), '{}')
+        assert.equal(yyjson.encode(yyjson.as_array({}), {
+            direct = direct,
+            markers = false,
+        }), '[]')
+    end
+    local err = assert.throws(yyjson.encode, t, {
+        markers = 'foo',
+    })
+    assert.match(err, 'markers must be boolean')
+
+    -- test that throws an error if the table has its own metatable
+    mt = {
+        __index = {},
+    }
+    t = setmetatable({}, mt)
+    err = assert.throws(yyjson.as_array, t)
+    assert.match(err, 'table already has a metatable')
+    assert.equal(getmetatable(t), mt)
+
+    -- test that throws an error if the argument is not a table
+    err = assert.throws(yyjson.as_array, 'foo')
+    assert.match(err, 'table expected')
+end
+
+function testcase.compile_encoder()
+    local point = yyjson.compile_encoder({
+        {
+            'x',
+            'number',
+        },
+        {
+            'y',
+            'number',
+        },
+    })
+    local enc = yyjson.compile_encoder({
+        {
+            'id',
+            'integer',
+        },
+        {
+            'name',
+            'string',
+        },
+        {
+            'ok',
+            'boolean',
+        },
+        {
+            'origin',
+            point,
+        },
+        {
+            'tags',
+        },
+    })
+    assert.match(tostring(enc), '^yyjson.encoder: ')
+    assert.equal(#enc, 5)
+
+    -- test that encode the fields in the order of the spec
+    local s = assert(enc:encode({
+        tags = {
+            'a',
+            'b',
+        },
+        origin = {
+            y = 2.5,
+            x = 1,
+        },
+        ok = true,
+        name = 'foo',
+        id = 1,
+        extra = 'ignored',
+    }))
+    assert.equal(s,
+                 '{"id":1,"name":"foo","ok":true,"origin":{"x":1,"y":2.5},"tags":["a","b"]}')
+
+    -- test that the nil fields are omitted
+    s = assert(enc:encode({
+        name = 'bar',
+    }))
+    assert.equal(s, '{"name":"bar"}')
+
+    -- test that encode with flags
+    s = assert(enc:encode({
+        id = 2,
+    }, nil, yyjson.WRITE_PRETTY))
+    assert.equal(s, '{\n    "id": 2\n}')
+    s = assert(enc:encode({
+        id = 3,
+        origin = {
+            x = 1,
+        },
+        tags = {},
+    }, nil, yyjson.WRITE_PRETTY))
+    assert.equal(s, table.concat({
+        '{',
+        '    "id": 3,',
+        '    "origin": {',
+        '        "x": 1',
+        '    },',
+        '    "tags": {}',
+        '}',
+    }, '\n'))
+
+    -- test that the values that cannot be encoded are omitted
+    s = assert(enc:encode({
+        id = 4,
+        origin = {},
+        tags = print,
+    }))
+    assert.equal(s, '{"id":4,"origin":{}}')
+
+    -- test that returns an error if the field value does not match the type
+    local v, err, errno = enc:encode({
+        id = 1.5,
+    })
+    assert.is_nil(v)
+    assert.match(err, "field 'id': integer expected, got number")
+    assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+
+    v, err, errno = enc:encode({
+        origin = {
+            x = 'a',
+        },
+    })
+    assert.is_nil(v)
+    assert.match(err, "field 'origin': field 'x': number expected, got string")
+    assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+
+    v, err, errno = enc:encode('foo')
+    assert.is_nil(v)
+    assert.match(err, 'table expected, got string')
+    assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+
+    -- test that limit memory usage
+    v, err, errno = enc:encode({
+        name = 'foo',
+    }, 1)
+    assert.is_nil(v)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.WRITE_ERROR_MEMORY_ALLOCATION)
+
+    -- test that the fields are looked up without __index, so the strict
+    -- table never raises an error and the arena can be reused
+    local arena = yyjson.arena()
+    local strict = setmetatable({
+        id = 5,
+    }, {
+        __index = function(_, k)
+            error('undefined field ' .. tostring(k))
+        end,
+    })
+    for _ = 1, 2 do
+        assert.equal(enc:encode(strict, arena), '{"id":5}')
+    end
+    assert.equal(enc:encode({
+        id = 6,
+    }, arena), '{"id":6}')
+
+    -- test that throws an error if the spec is invalid
+    err = assert.throws(yyjson.compile_encoder, {
+        'foo',
+    })
+    assert.match(err, 'field #1 must be table')
+    err = assert.throws(yyjson.compile_encoder, {
+        {
+            1,
+        },
+    })
+    assert.match(err, 'field #1 name must be string')
+    err = assert.throws(yyjson.compile_encoder, {
+        {
+            'foo',
+            'table',
+        },
+    })
+    assert.match(err, 'field #1 type must be')
+end
+
+function testcase.raw()
+    local fragment = yyjson.encode({
+        foo = {
+            1,
+            2,
+        },
+    })
+    local raw = yyjson.raw(fragment)
+    assert.match(tostring(raw), '^yyjson.raw: ')
+    assert.equal(#raw, #fragment)
+
+    -- test that the raw fragment is written as it is
+    local v = {
+        cached = raw,
+        list = {
+            raw,
+            yyjson.raw('1.50'),
+        },
+    }
+    local exp = {
+        cached = {
+            foo = {
+                1,
+                2,
+            },
+        },
+        list = {
+            {
+                foo = {
+                    1,
+                    2,
+                },
+            },
+            1.5,
+        },
+    }
+    for _, opts in ipairs({
+        {},
+        {
+            direct = true,
+        },
+    }) do
+        local s = assert(yyjson.encode(v, opts))
+        assert(s:find('1.50', 1, true))
+        assert.equal(yyjson.decode(s), exp)
+    end
+    assert.equal(yyjson.encode(raw), fragment)
+    assert.equal(yyjson.decode(assert(yyjson.writer()):encode(v)), exp)
+    local enc = yyjson.compile_encoder({
+        {
+            name = 'cached',
+        },
+    })
+    assert.equal(enc:encode(v), '{"cached":' .. fragment .. '}')
+
+    -- test that the mutable document copies the raw fragment
+    local doc = assert(yyjson.mutdoc('{}'))
+    assert(doc:set('/raw', yyjson.raw(string.rep('1', 3))))
+    collectgarbage('collect')
+    assert.equal(doc:encode(), '{"raw":111}')
+end
+
+function testcase.encode_circular_reference()
+    local t = {
+        foo = {},
+    }
+    t.foo.bar = t
+
+    -- test that returns an error for the circular reference
+    for _, opts in ipairs({
+        {},
+        {
+            direct = true,
+        },
+    }) do
+        local s, err, errno = yyjson.encode(t, opts)
+        assert.is_nil(s)
+        assert.match(err, 'circular reference')
+        assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+    end
+    local w = assert(yyjson.writer())
+    local s, err = w:encode({
+        t,
+    })
+    assert.is_nil(s)
+    assert.match(err, 'circular reference')
+    local _, errs = yyjson.encode_many({
+        1,
+        t,
+    })
+    assert.match(errs[2][1], 'circular reference')
+    local enc = yyjson.compile_encoder({
+        {
+            name = 'foo',
+        },
+    })
+    s, err = enc:encode(t)
+    assert.is_nil(s)
+    assert.match(err, "field 'foo': circular reference")
+
+    -- test that the shared table is not a circular reference
+    local shared = {
+        1,
+    }
+    assert.equal(yyjson.decode(yyjson.encode({
+        a = shared,
+        b = {
+            shared,
+            shared,
+        },
+    })), {
+        a = {
+            1,
+        },
+        b = {
+            {
+                1,
+            },
+            {
+                1,
+            },
+        },
+    })
+
+    -- test that returns an error if the nesting exceeds the maximum depth
+    local deep = {}
+    local v = deep
+    for _ = 1, 1000 do
+        v[1] = {}
+        v = v[1]
+    end
+    for _, opts in ipairs({
+        {},
+        {
+            direct = true,
+        },
+    }) do
+        s, err = yyjson.encode(deep, opts)
+        assert.is_nil(s)
+        assert.match(err, 'exceeded the maximum depth')
+
+        opts.max_depth = 1001
+        assert.is_string(yyjson.encode(deep, opts))
+        opts.max_depth = 0
+        assert.is_string(yyjson.encode(deep, opts))
+        opts.max_depth = 1
+        assert.equal(yyjson.encode({
+            1,
+        }, opts), '[1]')
+        s, err = yyjson.encode({
+            {},
+        }, opts)
+        assert.is_nil(s)
+        assert.match(err, 'exceeded the maximum depth')
+    end
+
+    -- test that throws an error if the option is invalid
+    err = assert.throws(yyjson.encode, t, {
+        max_depth = 'foo',
+    })
+    assert.match(err, 'max_depth must be number')
+end
+
+function testcase.encode_direct()
+    local t = {
+        1,
+        -2,
+        0,
+        1.5,
+        1e100,
+        'foo/"bar"\\baz',
+        'ctrl\n\t\1',
+        'ユニコード',
+        {},
+        setmetatable({}, {
+            __index = {},
+        }),
+        {
+            foo = {
+                bar = {
+                    true,
+                    false,
+                    yyjson.NULL,
+                },
+            },
+            empty = {
+                [-1] = yyjson.AS_ARRAY,
+            },
+            skip = print,
+        },
+        print,
+        [15] = 'sparse',
+        [13] = math.mininteger or -2 ^ 53,
+    }
+
+    -- test that the output is the same as the output of the yyjson writer
+    for _, flg in ipairs({
+        yyjson.WRITE_NOFLAG,
+        yyjson.WRITE_PRETTY,
+        yyjson.WRITE_PRETTY_TWO_SPACES,
+        yyjson.WRITE_ESCAPE_SLASHES,
+        yyjson.WRITE_ESCAPE_UNICODE,
+    }) do
+        for _, v in ipairs({
+            t,
+            {},
+            'foo',
+            1,
+            true,
+            print,
+        }) do
+            local exp = assert(yyjson.encode(v, nil, flg))
+            local act = assert(yyjson.encode(v, {
+                direct = true,
+            }, flg))
+            assert.equal(act, exp)
+        end
+    end
+
+    -- test that returns an error if the number is nan or inf
+    local v, err, errno = yyjson.encode({
+        1 / 0,
+    }, {
+        direct = true,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'nan or inf')
+    assert.equal(errno, yyjson.WRITE_ERROR_NAN_OR_INF)
+
+    -- test that limit memory usage
+    v, err, errno = yyjson.encode(t, {
+        direct = true,
+        mlimit = 16,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.WRITE_ERROR_MEMORY_ALLOCATION)
+end
+
+function testcase.writer()
+    local w = assert(yyjson.writer())
+    assert.match(tostring(w), '^yyjson.writer: ')
+    assert.equal(#w, 0)
+
+    -- test that encode the values with the same buffer
+    local v = {
+        foo = {
+            'bar',
+            1,
+            true,
+        },
+    }
+    for _ = 1, 3 do
+        assert.equal(w:encode(v), yyjson.encode(v))
+    end
+    local cap = #w
+    assert.greater(cap, 0)
+
+    -- test that the capacity stays at the high-water mark
+    local large = string.rep('x', cap * 4)
+    assert.equal(w:encode(large), '"' .. large .. '"')
+    assert.greater(#w, cap)
+    cap = #w
+    assert.equal(w:encode(1), '1')
+    assert.equal(#w, cap)
+
+    -- test that encode with flags
+    assert.equal(w:encode(v, yyjson.WRITE_PRETTY),
+                 yyjson.encode(v, nil, yyjson.WRITE_PRETTY))
+
+    -- test that encode with the options and the flags that follow them
+    assert.equal(w:encode({}, {
+        empty_table = 'array',
+    }), '[]')
+    assert.equal(w:encode({
+        {},
+    }, {
+        empty_table = 'array',
+    }, yyjson.WRITE_PRETTY_TWO_SPACES), '[\n  []\n]')
+    local s, err = w:encode({
+        {},
+    }, {
+        max_depth = 1,
+    })
+    assert.is_nil(s)
+    assert.match(err, 'exceeded the maximum depth')
+    err = assert.throws(w.encode, w, v, {
+        table_mode = 'foo',
+    })
+    assert.match(err, 'table_mode must be')
+
+    -- test that reset releases the buffer
+    w:reset()
+    assert.equal(#w, 0)
+    assert.equal(w:encode(v), yyjson.encode(v))
+
+    -- test that returns an error
+    local errno
+    s, err, errno = w:encode(0 / 0)
+    assert.is_nil(s)
+    assert.match(err, 'nan or inf')
+    assert.equal(errno, yyjson.WRITE_ERROR_NAN_OR_INF)
+
+    -- test that limit memory usage
+    w = assert(yyjson.writer(nil, 1024))
+    s, err, errno = w:encode(string.rep('x', 2048))
+    assert.is_nil(s)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.WRITE_ERROR_MEMORY_ALLOCATION)
+    assert.equal(w:encode('foo'), '"foo"')
+end
+
+function testcase.buffer_encode()
+    local buf = assert(yyjson.buffer())
+
+    -- test that append the JSON strings to the buffer
+    assert.equal(buf:write('HTTP/1.1 200 OK\r\n\r\n'), buf)
+    assert.equal(buf:encode({
+        foo = 'bar',
+    }), buf)
+    assert.equal(buf:encode({
+        1,
+        2,
+    }, yyjson.WRITE_PRETTY_TWO_SPACES), buf)
+    assert.equal(buf:tostring(),
+                 'HTTP/1.1 200 OK\r\n\r\n{"foo":"bar"}[\n  1,\n  2\n]')
+
+    -- test that append with the options
+    buf:reset()
+    assert.equal(buf:encode({}, {
+        empty_table = 'array',
+    }, yyjson.WRITE_PRETTY), buf)
+    assert.equal(buf:tostring(), '[]')
+    buf:reset()
+    assert.equal(buf:write('HTTP/1.1 200 OK\r\n\r\n'), buf)
+    assert.equal(buf:encode({
+        foo = 'bar',
+    }), buf)
+    assert.equal(buf:encode({
+        1,
+        2,
+    }, yyjson.WRITE_PRETTY_TWO_SPACES), buf)
+
+    -- test that the content is not changed on failure
+    local len = #buf
+    local v, err, errno = buf:encode({
+        'foo',
+        1 / 0,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'nan or inf')
+    assert.equal(errno, yyjson.WRITE_ERROR_NAN_OR_INF)
+    assert.equal(#buf, len)
+
+    -- test that return the pointer and length of the content
+    local ptr, n = buf:pointer()
+    assert.equal(type(ptr), 'userdata')
+    assert.equal(n, len)
+
+    -- test that remove the sent bytes
+    assert.equal(buf:consume(19), len - 19)
+    assert.equal(buf:tostring(), '{"foo":"bar"}[\n  1,\n  2\n]')
+    assert.equal(buf:consume(len), 0)
+    assert.equal(buf:tostring(), '')
+
+    -- test that the decoded value of the encoded content is the same
+    buf:encode({
+        foo = {
+            'bar',
+        },
+    })
+    assert.equal(yyjson.decode(buf), {
+        foo = {
+            'bar',
+        },
+    })
+end
+
+function testcase.decode_many()
+    -- test that decode the strings at once
+    local vals, errs = yyjson.decode_many({
+        '{"id":1,"name":"foo"}',
+        '{"id":2,"name":"bar"}',
+        '[1,2,3]',
+        '"baz"',
+    }, nil, nil, {
+        key_cache = true,
+    })
+    assert.is_nil(errs)
+    assert.equal(vals, {
+        {
+            id = 1,
+            name = 'foo',
+        },
+        {
+            id = 2,
+            name = 'bar',
+        },
+        {
+            1,
+            2,
+            3,
+        },
+        'baz',
+    })
+
+    -- test that the errors are returned at the same index
+    vals, errs = yyjson.decode_many({
+        '{"id":1}',
+        '[1,',
+        true,
+        '"foo"',
+    })
+    assert.equal(vals[1], {
+        id = 1,
+    })
+    assert.is_nil(vals[2])
+    assert.is_nil(vals[3])
+    assert.equal(vals[4], 'foo')
+    assert.is_nil(errs[1])
+    assert.match(errs[2][1], 'unexpected end')
+    assert.equal(errs[2][2], yyjson.READ_ERROR_UNEXPECTED_END)
+    assert.match(errs[3][1], 'string expected, got boolean')
+    assert.equal(errs[3][2], yyjson.READ_ERROR_INVALID_PARAMETER)
+
+    -- test that limit memory usage of each string
+    vals, errs = yyjson.decode_many({
+        '1',
+        '[' .. string.rep('1,', 1000) .. '1]',
+    }, nil, nil, 256)
+    assert.equal(vals[1], 1)
+    assert.equal(errs[2][2], yyjson.READ_ERROR_MEMORY_ALLOCATION)
+
+    -- test that the values that exceed the max_depth are the errors
+    vals, errs = yyjson.decode_many({
+        '[1]',
+        '[[1]]',
+    }, nil, nil, {
+        max_depth = 1,
+    })
+    assert.equal(vals[1], {
+        1,
+    })
+    assert.is_nil(vals[2])
+    assert.match(errs[2][1], 'exceeded the maximum depth')
+    assert.equal(errs[2][2], yyjson.READ_ERROR_JSON_STRUCTURE)
+
+    -- test that decode with the arena
+    local arena = assert(yyjson.arena())
+    vals = assert(yyjson.decode_many({
+        '[1]',
+        '[2]',
+    }, nil, nil, arena))
+    assert.equal(vals, {
+        {
+            1,
+        },
+        {
+            2,
+        },
+    })
+
+    -- test that throws an error if list is not a table
+    local err = assert.throws(yyjson.decode_many, '[1]')
+    assert.match(err, 'table expected')
+end
+
+function testcase.encode_many()
+    -- test that encode the values at once
+    local vals, errs = yyjson.encode_many({
+        {
+            id = 1,
+        },
+        {
+            1,
+            2,
+        },
+        'foo',
+    })
+    assert.is_nil(errs)
+    assert.equal(vals, {
+        '{"id":1}',
+        '[1,2]',
+        '"foo"',
+    })
+
+    -- test that encode with flags
+    vals = yyjson.encode_many({
+        {
+            1,
+        },
+    }, nil, yyjson.WRITE_PRETTY)
+    assert.equal(vals, {
+        '[\n    1\n]',
+    })
+
+    -- test that the errors are returned at the same index
+    vals, errs = yyjson.encode_many({
+        1,
+        0 / 0,
+        3,
+    })
+    assert.equal(vals[1], '1')
+    assert.is_nil(vals[2])
+    assert.equal(vals[3], '3')
+    assert.match(errs[2][1], 'nan or inf')
+    assert.equal(errs[2][2], yyjson.WRITE_ERROR_NAN_OR_INF)
+
+    -- test that throws an error if list is not a table
+    local err = assert.throws(yyjson.encode_many, '[1]')
+    assert.match(err, 'table expected')
+end
+
+function testcase.mutdoc()
+    local s = '{"id":1,"user":{"name":"foo","tags":["a","b"]},"extra":null}'
+
+    -- test that edit the document without decoding it
+    local doc = assert(yyjson.mutdoc(s))
+    assert.match(tostring(doc), '^yyjson.mutdoc: ')
+    assert.greater(#doc, 0)
+    assert.equal(doc:get('/user/name'), 'foo')
+    assert.equal(doc:get('/user/tags'), {
+        'a',
+        'b',
+    })
+    assert.equal(doc:get('/extra', true), yyjson.NULL)
+    assert.is_true(doc:set('/user/name', 'bar'))
+    assert.is_true(doc:set('/user/tags/1', {
+        qux = true,
+    }))
+    assert.is_true(doc:remove('/extra'))
+    assert.equal(yyjson.decode(doc:encode()), {
+        id = 1,
+        user = {
+            name = 'bar',
+            tags = {
+                'a',
+                {
+                    qux = true,
+                },
+            },
+        },
+    })
+
+    -- test that the strings are kept after the Lua values are collected
+    assert.is_true(doc:set('/copied', {
+        [string.rep('k', 3)] = string.rep('v', 3),
+    }))
+    collectgarbage('collect')
+    assert.equal(doc:get('/copied'), {
+        kkk = 'vvv',
+    })
+    assert.is_true(doc:remove('/copied'))
+
+    -- test that set the value with creating the parents
+    assert.is_true(doc:set('/meta/version', 2, true))
+    assert.equal(doc:get('/meta/version'), 2)
+    assert.equal(doc:get(''), yyjson.decode(doc:encode()))
+
+    -- test that returns the error of the pointer
+    local v, err, errno = doc:get('/unknown')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.PTR_ERR_RESOLVE)
+    v, err, errno = doc:set('/foo/bar', 1)
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.PTR_ERR_RESOLVE)
+    v, err, errno = doc:remove('foo')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.PTR_ERR_SYNTAX)
+
+    -- test that apply the JSON Patch
+    doc = assert(yyjson.mutdoc(s))
+    assert.is_true(doc:patch('[{"op":"replace","path":"/id","value":2}]'))
+    assert.is_true(doc:patch({
+        {
+            op = 'add',
+            path = '/user/tags/0',
+            value = 'z',
+        },
+        {
+            op = 'remove',
+            path = '/extra',
+        },
+    }))
+    assert.equal(yyjson.decode(doc:encode()), {
+        id = 2,
+        user = {
+            name = 'foo',
+            tags = {
+                'z',
+                'a',
+                'b',
+            },
+        },
+    })
+    v, err = doc:patch('[{"op":"test","path":"/id","value":1}]')
+    assert.is_nil(v)
+    assert.match(err, 'operation #1')
+    v, err = doc:patch('[{"op":"remove","path":"/unknown"}]')
+    assert.is_nil(v)
+    assert.match(err, 'operation #1')
+    v, err, errno = doc:patch('[')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+
+    -- test that apply the JSON Merge Patch
+    assert.is_true(doc:merge_patch('{"id":null,"user":{"name":"bar"}}'))
+    assert.is_true(doc:merge_patch({
+        user = {
+            age = 20,
+        },
+    }))
+    assert.equal(yyjson.decode(doc:encode()), {
+        user = {
+            name = 'bar',
+            age = 20,
+            tags = {
+                'z',
+                'a',
+                'b',
+            },
+        },
+    })
+
+    -- test that the circular reference cannot be set
+    local t = {}
+    t.t = t
+    v, err, errno = doc:set('/t', t)
+    assert.is_nil(v)
+    assert.match(err, 'circular reference')
+    assert.equal(errno, yyjson.WRITE_ERROR_INVALID_VALUE_TYPE)
+
+    -- test that returns the error of the invalid JSON
+    v, err, errno = yyjson.mutdoc('{"foo":}')
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+
+    -- test that returns the error of the memory limit
+    v, err, errno = yyjson.mutdoc(s, 16)
+    assert.is_nil(v)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
+end
+
+function testcase.decoder()
+    local v = {
+        foo = 'bar\n"baz"',
+        list = {
+            1,
+            2.5,
+            true,
+        },
+    }
+    local s = yyjson.encode(v)
+
+    -- test that decode the document that is fed by chunks
+    local dec = assert(yyjson.decoder())
+    assert.match(tostring(dec), '^yyjson.decoder: ')
+    for i = 1, #s, 3 do
+        assert.is_true(dec:feed(s:sub(i, i + 2)))
+    end
+    assert.equal(#dec, #s)
+    local act, err, errno, len = dec:finish()
+    assert.equal(act, v)
+    assert.is_nil(err)
+    assert.is_nil(errno)
+    assert.equal(len, #s)
+    assert.equal(#dec, 0)
+
+    -- test that the decoder can be reused after finish
+    assert(dec:feed('[1,'))
+    act, err, errno = dec:finish()
+    assert.is_nil(act)
+    assert.match(err, 'at 3')
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_END)
+    assert(dec:feed('[1, null]'))
+    assert.equal(dec:finish(), {
+        1,
+    })
+
+    -- test that emit the NDJSON values as soon as the lines are complete
+    dec = assert(yyjson.decoder(true, nil, {
+        ndjson = true,
+        key_cache = true,
+    }))
+    local ndjson = s .. '\n\n' .. s .. '\r\n' .. '[null]\n' .. s
+    local vals = {}
+    for i = 1, #ndjson, 7 do
+        for _, val in ipairs(assert(dec:feed(ndjson:sub(i, i + 6)))) do
+            vals[#vals + 1] = val
+        end
+    end
+    assert.equal(#vals, 3)
+    assert.equal(vals[1], v)
+    assert.equal(vals[2], v)
+    assert.equal(vals[3], {
+        yyjson.NULL,
+    })
+    assert.equal(#dec, #s)
+    assert.equal(dec:finish(), {
+        v,
+    })
+    assert.equal(dec:finish(), {})
+
+    -- test that returns the error with the offset in the stream
+    assert.equal(dec:feed('1\n2'), {
+        1,
+    })
+    act, err, errno = dec:feed('3\n{"foo":}\n')
+    assert.is_nil(act)
+    assert.match(err, 'at 12')
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+    assert.equal(#dec, 0)
+
+    -- test that returns the error number if the value cannot be pushed
+    for _, ndjson in ipairs({
+        true,
+        false,
+    }) do
+        dec = assert(yyjson.decoder(nil, nil, {
+            ndjson = ndjson,
+            max_depth = 1,
+        }))
+        if ndjson then
+            act, err, errno = dec:feed('[[1]]\n')
+        else
+            assert.is_true(dec:feed('[[1]]'))
+            act, err, errno = dec:finish()
+        end
+        assert.is_nil(act)
+        assert.match(err, 'exceeded the maximum depth')
+        assert.equal(errno, yyjson.READ_ERROR_JSON_STRUCTURE)
+    end
+
+    -- test that returns the error of the memory limit
+    dec = assert(yyjson.decoder(nil, nil, 16))
+    act, err, errno = dec:feed(s)
+    assert.is_nil(act)
+    assert.match(err, 'memory')
+    assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
+
+    -- test that throws an error if an arena is specified
+    err = assert.throws(yyjson.decoder, nil, nil, yyjson.arena())
+    assert.match(err, 'arena cannot be used')
+end
+
+function testcase.decode_async()
+    local lines = {}
+    for i = 1, 10000 do
+        lines[i] = {
+            id = i,
+            name = 'name-' .. i,
+        }
+    end
+    local s = yyjson.encode(lines)
+
+    -- test that decode the JSON string in the background thread
+    local handles = {}
+    for i = 1, 8 do
+        handles[i] = assert(yyjson.decode_async(s))
+        assert.match(tostring(handles[i]), '^yyjson.async: ')
+        assert.greater(handles[i]:fd(), -1)
+    end
+    for _, h in ipairs(handles) do
+        local v, err, errno, len = h:result()
+        assert.equal(v, lines)
+        assert.is_nil(err)
+        assert.is_nil(errno)
+        assert.equal(len, #s)
+        assert.is_true(h:done())
+        assert.equal(h:fd(), -1)
+
+        -- test that the result can be retrieved only once
+        v, err, errno = h:result()
+        assert.is_nil(v)
+        assert.match(err, 'already')
+        assert.equal(errno, yyjson.READ_ERROR_INVALID_PARAMETER)
+    end
+
+    -- test that with_null and with_ref are applied
+    local h = assert(yyjson.decode_async('[1,null]', true, true))
+    assert.equal(h:result(), {
+        [-1] = yyjson.AS_ARRAY,
+        1,
+        yyjson.NULL,
+    })
+
+    -- test that returns the error
+    h = assert(yyjson.decode_async('{"foo":}'))
+    local v, err, errno = h:result()
+    assert.is_nil(v)
+    assert.is_string(err)
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+
+    -- test that returns the error of the memory limit
+    h = assert(yyjson.decode_async(s, nil, nil, {
+        mlimit = 1024,
+    }))
+    v, err, errno = h:result()
+    assert.is_nil(v)
+    assert.equal(errno, yyjson.READ_ERROR_MEMORY_ALLOCATION)
+
+    -- test that the handle can be released before the parsing is done
+    for _ = 1, 8 do
+        assert(yyjson.decode_async(s))
+    end
+    collectgarbage('collect')
+
+    -- test that throws an error if an arena is specified
+    err = assert.throws(yyjson.decode_async, '1', nil, nil, yyjson.arena())
+    assert.match(err, 'arena cannot be used')
+
+    -- test that the decode options are applied to the result
+    h = assert(yyjson.decode_async('{"foo":{"bar":[1]},"baz":"qux"}', nil,
+                                   nil, {
+        keep = {
+            '/foo',
+        },
+        key_cache = true,
+    }))
+    assert.equal(h:result(), {
+        foo = {
+            bar = {
+                1,
+            },
+        },
+    })
+    h = assert(yyjson.decode_async('[[[1]]]', nil, nil, {
+        max_depth = 2,
+    }))
+    v, err = h:result()
+    assert.is_nil(v)
+    assert.match(err, 'maximum depth')
+    h = assert(yyjson.decode_async('[1]', nil, nil, {
+        raw_number = 'string',
+    }, yyjson.READ_NUMBER_AS_RAW))
+    assert.equal(h:result(), {
+        '1',
+    })
+    err = assert.throws(yyjson.decode_async, '1', nil, nil, {
+        max_depth = 'foo',
+    })
+    assert.match(err, 'max_depth must be number')
+end
+
+function testcase.decode_parallel()
+    -- create the large input that is split into the chunks
+    local records = {}
+    local lines = {}
+    for i = 1, 20000 do
+        records[i] = {
+            id = i,
+            name = 'name-' .. i,
+            tags = {
+                'a,]}',
+                'b\\"',
+            },
+        }
+        lines[i] = yyjson.encode(records[i])
+    end
+    local ndjson = table.concat(lines, '\n') .. '\n'
+    local array = '[' .. table.concat(lines, ',\n') .. ']'
+    assert.greater(#ndjson, 65536 * 4)
+
+    -- test that decode the NDJSON in parallel
+    for _, threads in ipairs({
+        1,
+        4,
+    }) do
+        local vals = assert(yyjson.decode_parallel(ndjson, nil, nil, {
+            threads = threads,
+            key_cache = true,
+        }))
+        assert.equal(vals, records)
+
+        -- test that decode the top-level array in parallel
+        vals = assert(yyjson.decode_parallel(array, nil, nil, {
+            threads = threads,
+            array = true,
+        }))
+        assert.equal(vals, records)
+    end
+
+    -- test that decode the small input
+    assert.equal(yyjson.decode_parallel('1\n"foo"\n\n[2]'), {
+        1,
+        'foo',
+        {
+            2,
+        },
+    })
+    assert.equal(yyjson.decode_parallel('', nil, nil, {
+        array = false,
+    }), {})
+    assert.equal(yyjson.decode_parallel(' [ ] ', nil, nil, {
+        array = true,
+    }), {})
+    assert.equal(yyjson.decode_parallel('[1,null,3]', true, true, {
+        array = true,
+    }), {
+        [-1] = yyjson.AS_ARRAY,
+        1,
+        yyjson.NULL,
+        3,
+    })
+
+    -- test that returns the first error in the input
+    local v, err, errno = yyjson.decode_parallel(ndjson .. '{"foo":}\n' ..
+                                                     ndjson, nil, nil, {
+        threads = 4,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'at ' .. #ndjson + 7 .. '$')
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+
+    for _, s in ipairs({
+        '[1,2',
+        '[1,2,]',
+        '[1 2]',
+        '[1,2}',
+        '[1] 2',
+        '{}',
+    }) do
+        v, err, errno = yyjson.decode_parallel(s, nil, nil, {
+            array = true,
+        })
+        assert.is_nil(v)
+        assert.is_string(err)
+        assert.equal(type(errno), 'number')
+    end
+    assert.equal(yyjson.decode_parallel('[1,2,]', nil, nil, {
+        array = true,
+    }, yyjson.READ_ALLOW_TRAILING_COMMAS), {
+        1,
+        2,
+    })
+
+    -- test that the small input is split into the chunks by min_chunk option
+    -- and the errors are the same as the single-threaded decoding
+    for _, s in ipairs({
+        '[1,2,3,4,5,6,7,8]',
+        '[1,2,]',
+        '[1,,2]',
+        '[1, ,2,3,4]',
+        '[1,2,,]',
+        '[1,2,3 4,5,6]',
+        '[1,{"a":},3,4]',
+        '[1,"a,b",[2,3],{"c":[4,5]},6]',
+    }) do
+        for _, flg in ipairs({
+            yyjson.READ_NOFLAG,
+            yyjson.READ_ALLOW_TRAILING_COMMAS,
+        }) do
+            local exp, experr, experrno = yyjson.decode_parallel(s, nil, nil,
+                                                                 {
+                array = true,
+                threads = 1,
+                min_chunk = 1,
+            }, flg)
+            v, err, errno = yyjson.decode_parallel(s, nil, nil, {
+                array = true,
+                threads = 4,
+                min_chunk = 1,
+            }, flg)
+            assert.equal(v, exp)
+            assert.equal(errno, experrno)
+            if experr then
+                -- the messages may differ, but the positions are the same
+                assert.equal(err:match('at %d+$'), experr:match('at %d+$'))
+            end
+        end
+    end
+    assert.equal(yyjson.decode_parallel('[1,2,]', nil, nil, {
+        array = true,
+        threads = 4,
+        min_chunk = 1,
+    }, yyjson.READ_ALLOW_TRAILING_COMMAS), {
+        1,
+        2,
+    })
+    v, err, errno = yyjson.decode_parallel('[1,,2]', nil, nil, {
+        array = true,
+        threads = 4,
+        min_chunk = 1,
+    }, yyjson.READ_ALLOW_TRAILING_COMMAS)
+    assert.is_nil(v)
+    assert.match(err, 'at 3$')
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+
+    -- test that returns the first error of the split NDJSON
+    v, err, errno = yyjson.decode_parallel('1\n2\n{"foo":}\n3\n[\n', nil, nil,
+                                           {
+        threads = 4,
+        min_chunk = 1,
+    })
+    assert.is_nil(v)
+    assert.match(err, 'at 11$')
+    assert.equal(errno, yyjson.READ_ERROR_UNEXPECTED_CHARACTER)
+
+    -- test that throws an error if the arena is specified
+    err = assert.throws(yyjson.decode_parallel, '[1]', nil, nil,
+                        yyjson.arena())
+    assert.match(err, 'arena cannot be used')
+end